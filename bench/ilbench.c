@@ -0,0 +1,178 @@
+/*
+ * Compile throughput benchmark.
+ *
+ * Runs the phases of process on one thread over the given IL file, as
+ * process_function does, and reports time of every stage: lexem_parse,
+ * remap (remap_gns and remap_vars), cmd_form (with the function header),
+ * allocate and asm_emit. Lexing and remap are measured in lexems per
+ * second, the rest in commands per second. Peak RSS is the one of the
+ * whole run. Output is not written anywhere.
+ *
+ *	make bench CFLAGS=-O2
+ *	bench/ilbench [-f elf64] <file>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "global.h"
+#include "lparse.h"
+#include "remap.h"
+#include "func.h"
+#include "alloc.h"
+#include "emit.h"
+
+enum {
+	bs_lex,
+	bs_remap,
+	bs_cmd_form,
+	bs_allocate,
+	bs_emit,
+	stages_number
+};
+
+static const char *stage_names[] = {
+	[bs_lex] = "lexem_parse",
+	[bs_remap] = "remap",
+	[bs_cmd_form] = "cmd_form",
+	[bs_allocate] = "allocate",
+	[bs_emit] = "asm_emit"
+};
+
+struct bench {
+	struct gn_sym_tbl tb;
+	struct intern_tbl names;
+	struct var_map vm;
+	int bin;
+	double time[stages_number];
+	long lexems;
+	long cmds;
+	long funcs;
+	long bytes;
+};
+
+static void run(struct bench *b, char *filename);
+static void report(struct bench *b);
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+
+	memset(&b, 0, sizeof(struct bench));
+	if (argc == 4 && strcmp(argv[1], "-f") == 0 &&
+			strcmp(argv[2], "elf64") == 0)
+		b.bin = 1;
+	else if (argc != 2)
+		die("Usage: %s [-f elf64] <file>\n", argv[0]);
+	run(&b, argv[argc - 1]);
+	report(&b);
+	return 0;
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void function_run(struct bench *b, struct lexem_list *l, int gl_spec);
+
+static void run(struct bench *b, char *filename)
+{
+	struct lexem_list *l, *fl;
+	struct lexem_block lb;
+	double start;
+	int gl_spec = 0;
+
+	start = now();
+	l = lexem_parse(filename);
+	b->time[bs_lex] += now() - start;
+	b->lexems = ll_end(l) - ll_begin(l);
+
+	start = now();
+	intern_init(&b->names);
+	remap_gns(l, &b->tb, &b->names);
+	b->time[bs_remap] += now() - start;
+	var_map_init(&b->vm, &b->names);
+
+	while (ll_get(l, &lb)) {
+		if (lb.lt == lx_global_spec) {
+			gl_spec = 1;
+		} else if (lb.lt == lx_func_decl) {
+			fl = ll_extract_upto_lt(l, lx_close_brace);
+			if (fl == NULL)
+				die("%s: function is not closed\n", filename);
+			function_run(b, fl, gl_spec);
+			gl_spec = 0;
+		}
+	}
+	var_map_free(&b->vm);
+	gn_sym_tbl_free(&b->tb);
+	intern_free(&b->names);
+	ll_free(l);
+}
+
+static void function_run(struct bench *b, struct lexem_list *l, int gl_spec)
+{
+	struct function f;
+	struct fcall_list fcl = { NULL, NULL };
+	struct cmd_list_el *c;
+	struct emitter em;
+	double start;
+
+	arena_init(&f.ar);
+	start = now();
+	remap_vars(l, &f.stb, &b->names, &b->vm);
+	b->time[bs_remap] += now() - start;
+
+	start = now();
+	func_header_form(l, &f, gl_spec, &b->tb);
+	cmd_form(l, &f, &b->tb, &fcl);
+	b->time[bs_cmd_form] += now() - start;
+	for (c = f.cl->first; c; c = c->next)
+		++b->cmds;
+
+	start = now();
+	f.alloc_table = allocate(&f);
+	b->time[bs_allocate] += now() - start;
+
+	emitter_init(&em, b->bin);
+	start = now();
+	asm_emit(&em, &f);
+	b->time[bs_emit] += now() - start;
+	b->bytes += em.out.len;
+	++b->funcs;
+
+	emitter_free(&em);
+	fcall_list_free(&fcl);
+	var_sym_tbl_free(&f.stb);
+	arena_free(&f.ar);
+	ll_free(l);
+}
+
+static void report(struct bench *b)
+{
+	struct rusage ru;
+	double total = 0;
+	int i;
+
+	printf("%ld functions, %ld lexems, %ld commands, %ld bytes of %s\n",
+			b->funcs, b->lexems, b->cmds, b->bytes,
+			b->bin ? "code" : "assembly");
+	for (i = 0; i < stages_number; ++i) {
+		double t = b->time[i];
+		long n = i == bs_lex || i == bs_remap ? b->lexems : b->cmds;
+		total += t;
+		printf("%-12s %9.3f ms %12.0f %s/s\n", stage_names[i], t * 1e3,
+				t > 0 ? n / t : 0.0,
+				i == bs_lex || i == bs_remap ? "lexems" : "commands");
+	}
+	printf("%-12s %9.3f ms %12.0f commands/s\n", "total", total * 1e3,
+			total > 0 ? b->cmds / total : 0.0);
+	getrusage(RUSAGE_SELF, &ru);
+	printf("peak RSS     %9ld KB\n", ru.ru_maxrss);
+}
@@ -0,0 +1,270 @@
+/*
+ * Generator of synthetic IL modules for benchmarks.
+ *
+ * Every function takes 1 to <args> arguments (less than func_max_args)
+ * and is global with probability 1/2. Its body is <cmds> commands, each
+ * of them assigns a new variable. Operands are taken from the last <live>
+ * variables, so about that many values are alive at any command. A
+ * command is a call of a random function of the module with probability
+ * <calls>%, a copy of a number with probability 1/8 and arithmetic
+ * otherwise. With <moves>% instead of all these it is a copy of a
+ * variable, that is not used after it, as front ends emit.
+ *
+ * With -r the module may be run: functions of odd numbers call only those
+ * of even ones, which call nothing, divisors are copies of numbers other
+ * than 0 and -1, and <driver> gets a C program, that calls every global
+ * function and prints the results.
+ *
+ *	bench/ilgen [-f <funcs>] [-c <cmds>] [-l <live>] [-p <calls>]
+ *	            [-m <moves>] [-a <args>] [-s <seed>] [-r <driver>]
+ *	            [-o <file>]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "func.h"
+
+static const char *msg_usage =
+"Usage: %s [-f <funcs>] [-c <cmds>] [-l <live>] [-p <calls>] [-m <moves>]\n"
+"          [-a <args>] [-s <seed>] [-r <driver>] [-o <file>]\n";
+
+struct knobs {
+	int funcs;
+	int cmds;
+	int live;
+	int calls;				/* percent of commands */
+	int moves;				/* percent of commands */
+	int args;				/* max, at least 1 */
+	unsigned long long seed;
+	char *driver_file;		/* runnable module, if not NULL */
+	char *output_file;
+};
+
+static const char *ops[] = {
+	"add", "sub", "mul", "umul", "div", "udiv", "rem", "urem"
+};
+
+static void knobs_get(int argc, char **argv, struct knobs *k);
+static void gen_module(FILE *f, struct knobs *k);
+
+int main(int argc, char **argv)
+{
+	struct knobs k;
+	FILE *f = stdout;
+
+	knobs_get(argc, argv, &k);
+	if (k.output_file && (f = fopen(k.output_file, "w")) == NULL)
+		die("%s: can't create\n", k.output_file);
+	gen_module(f, &k);
+	if (fclose(f) == EOF)
+		die("%s: write error\n", k.output_file ? k.output_file : "stdout");
+	return 0;
+}
+
+static int knob(char **argv, int i, int argc, int min, int max)
+{
+	int tmp;
+	if (i + 1 == argc)
+		die("%s: missing value\n", argv[i]);
+	tmp = atoi(argv[i + 1]);
+	if (tmp < min || tmp > max)
+		die("%s: must be in range %d-%d\n", argv[i], min, max);
+	return tmp;
+}
+
+static void knobs_get(int argc, char **argv, struct knobs *k)
+{
+	int i;
+
+	k->funcs = 1000;
+	k->cmds = 32;
+	k->live = 8;
+	k->calls = 10;
+	k->moves = 0;
+	k->args = 6;
+	k->seed = 1;
+	k->driver_file = NULL;
+	k->output_file = NULL;
+	for (i = 1; i < argc; i += 2) {
+		if (strcmp(argv[i], "-f") == 0)
+			k->funcs = knob(argv, i, argc, 1, 1 << 24);
+		else if (strcmp(argv[i], "-c") == 0)
+			k->cmds = knob(argv, i, argc, 1, 1 << 24);
+		else if (strcmp(argv[i], "-l") == 0)
+			k->live = knob(argv, i, argc, 1, 1 << 24);
+		else if (strcmp(argv[i], "-p") == 0)
+			k->calls = knob(argv, i, argc, 0, 100);
+		else if (strcmp(argv[i], "-m") == 0)
+			k->moves = knob(argv, i, argc, 0, 100);
+		else if (strcmp(argv[i], "-a") == 0)
+			k->args = knob(argv, i, argc, 1, func_max_args - 1);
+		else if (strcmp(argv[i], "-s") == 0)
+			k->seed = knob(argv, i, argc, 0, 1 << 30);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			k->driver_file = argv[i + 1];
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			k->output_file = argv[i + 1];
+		else
+			die(msg_usage, argv[0]);
+	}
+}
+
+/* xorshift64*, output does not depend on libc */
+static unsigned long long rnd_state;
+
+static unsigned int rnd(unsigned int n)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return (rnd_state * 2685821657736338717ull >> 32) % n;
+}
+
+/* Variables are numbered: arguments first, then results of commands */
+static void put_var(FILE *f, int v, int argnum)
+{
+	if (v < argnum)
+		fprintf(f, "%%a%d", v);
+	else
+		fprintf(f, "%%t%d", v - argnum);
+}
+
+/* Flags of variables */
+enum {
+	var_moved = 1,
+	var_divisor = 2			/* number, that is safe to divide by */
+};
+
+/* One of the last live variables, moved ones are tried to be avoided */
+static int pick(int defined, int live, char *flags)
+{
+	int window = defined < live ? defined : live;
+	int i, v;
+
+	for (i = 0; i < 4; ++i) {
+		v = defined - 1 - rnd(window);
+		if ((flags[v] & var_moved) == 0)
+			return v;
+	}
+	return defined - 1;
+}
+
+/* The last live divisor or -1 */
+static int pick_divisor(int defined, int live, char *flags)
+{
+	int v;
+	for (v = defined - 1; v >= 0 && v >= defined - live; --v) {
+		if (flags[v] & var_divisor)
+			return v;
+	}
+	return -1;
+}
+
+static void gen_command(FILE *f, struct knobs *k, int *sig, int defined,
+		int argnum, char *flags, int caller)
+{
+	int run = k->driver_file != NULL;
+	int i, callee, v, op, num;
+
+	put_var(f, defined, argnum);
+	if (k->moves && rnd(100) < k->moves) {
+		v = pick(defined, k->live, flags);
+		flags[v] |= var_moved;
+		fprintf(f, " = copy ");
+		put_var(f, v, argnum);
+		fprintf(f, "\n");
+	} else if (rnd(100) < k->calls && (!run || caller % 2)) {
+		callee = run ? 2 * rnd((k->funcs + 1) / 2) : rnd(k->funcs);
+		fprintf(f, " = call $f%d(", callee);
+		for (i = 0; i < sig[callee]; ++i) {
+			if (i)
+				fprintf(f, ", ");
+			put_var(f, pick(defined, k->live, flags), argnum);
+		}
+		fprintf(f, ")\n");
+	} else if (rnd(8) == 0) {
+		num = (int)rnd(2001) - 1000;
+		if (run && (num == 0 || num == -1))
+			num = 1000;
+		if (run)
+			flags[defined] |= var_divisor;
+		fprintf(f, " = copy %d\n", num);
+	} else {
+		/* Division family is the second half of ops */
+		op = rnd(sizeof(ops) / sizeof(ops[0]));
+		v = -1;
+		if (run && op >= 4 &&
+				(v = pick_divisor(defined, k->live, flags)) == -1)
+			op -= 4;
+		fprintf(f, " = %s ", ops[op]);
+		put_var(f, pick(defined, k->live, flags), argnum);
+		fprintf(f, ", ");
+		put_var(f, v == -1 ? pick(defined, k->live, flags) : v, argnum);
+		fprintf(f, "\n");
+	}
+}
+
+static void gen_driver(struct knobs *k, int *sig, char *global)
+{
+	FILE *f = fopen(k->driver_file, "w");
+	int i, j;
+
+	if (f == NULL)
+		die("%s: can't create\n", k->driver_file);
+	fprintf(f, "#include <stdio.h>\n\n");
+	for (i = 0; i < k->funcs; ++i) {
+		if (global[i] == 0)
+			continue;
+		fprintf(f, "long f%d(", i);
+		for (j = 0; j < sig[i]; ++j)
+			fprintf(f, j ? ", long" : "long");
+		fprintf(f, ");\n");
+	}
+	fprintf(f, "\nint main(void)\n{\n");
+	for (i = 0; i < k->funcs; ++i) {
+		if (global[i] == 0)
+			continue;
+		fprintf(f, "\tprintf(\"%%ld\\n\", f%d(", i);
+		for (j = 0; j < sig[i]; ++j)
+			fprintf(f, j ? ", %dL" : "%dL", (int)rnd(2001) - 1000);
+		fprintf(f, "));\n");
+	}
+	fprintf(f, "\treturn 0;\n}\n");
+	if (fclose(f) == EOF)
+		die("%s: write error\n", k->driver_file);
+}
+
+static void gen_module(FILE *f, struct knobs *k)
+{
+	int *sig = smalloc(k->funcs * sizeof(int));
+	char *global = smalloc(k->funcs);
+	char *flags = smalloc(func_max_args + k->cmds);
+	int i, j;
+
+	rnd_state = k->seed * 0x9e3779b97f4a7c15ull + 1;
+	for (i = 0; i < k->funcs; ++i)
+		sig[i] = 1 + rnd(k->args);
+	for (i = 0; i < k->funcs; ++i) {
+		global[i] = rnd(2);
+		fprintf(f, "%sfunc i $f%d(", global[i] ? "global\n" : "", i);
+		for (j = 0; j < sig[i]; ++j)
+			fprintf(f, j ? ", %%a%d" : "%%a%d", j);
+		fprintf(f, ") {\n");
+		memset(flags, 0, func_max_args + k->cmds);
+		for (j = 0; j < k->cmds; ++j) {
+			fprintf(f, "\t");
+			gen_command(f, k, sig, sig[i] + j, sig[i], flags, i);
+		}
+		fprintf(f, "\tret ");
+		put_var(f, sig[i] + k->cmds - 1, sig[i]);
+		fprintf(f, "\n}\n\n");
+	}
+	if (k->driver_file)
+		gen_driver(k, sig, global);
+	free(flags);
+	free(global);
+	free(sig);
+}
@@ -0,0 +1,120 @@
+/*
+ * Check of the JIT library, see jit.h.
+ *
+ * A module is compiled in memory, its functions are called directly and
+ * through each other, and an extern is taken from the lookup callback.
+ * Local functions are not visible by name. Modules with a syntax error,
+ * an undeclared variable or an extern, that lookup doesn't know, give
+ * NULL and a diagnostic in the context. Exit status is the number of
+ * failed checks.
+ *
+ *	make jitcheck
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ctx.h"
+#include "jit.h"
+
+static const char *good =
+	"global\n"
+	"func i $sum3(%a, %b, %c) {\n"
+	"\t%t = add %a, %b\n"
+	"\t%r = add %t, %c\n"
+	"\tret %r\n"
+	"}\n"
+	"\n"
+	"func i $square(%x) {\n"
+	"\t%y = mul %x, %x\n"
+	"\tret %y\n"
+	"}\n"
+	"\n"
+	"global\n"
+	"func i $scaled_square(%x) {\n"
+	"\t%s = call $square(%x)\n"
+	"\t%r = call $scale(%s)\n"
+	"\tret %r\n"
+	"}\n";
+
+static const struct {
+	char *what;
+	char *src;
+} bad[] = {
+	{ "syntax error",
+		"global\nfunc i $f(%a, %b) {\n\t%c = add %a %b\n\tret %c\n}\n" },
+	{ "undeclared variable",
+		"global\nfunc i $f(%a) {\n\tret %b\n}\n" },
+	{ "unknown extern",
+		"global\nfunc i $f(%a) {\n\t%b = call $nosuch(%a)\n\tret %b\n}\n" }
+};
+
+static int failed;
+
+static void check(int ok, char *what)
+{
+	printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		++failed;
+}
+
+static long scale(long x)
+{
+	return x * 10;
+}
+
+static void *lookup(void *arg, const char *name)
+{
+	++*(int *)arg;
+	return strcmp(name, "scale") == 0 ? (void *)scale : NULL;
+}
+
+static void check_good(struct ctx *c)
+{
+	long (*sum3)(long, long, long);
+	long (*scaled_square)(long);
+	struct ilc_jit *j;
+	int lookups = 0;
+
+	j = ilc_jit_compile(c, good, strlen(good), lookup, &lookups);
+	check(j != NULL && c->diags_len == 0, "compile");
+	if (j == NULL)
+		return;
+	check(lookups == 1, "extern through lookup");
+	sum3 = (long (*)(long, long, long))ilc_jit_sym(j, "sum3");
+	scaled_square = (long (*)(long))ilc_jit_sym(j, "scaled_square");
+	check(sum3 && sum3(1, 20, 300) == 321, "call");
+	check(scaled_square && scaled_square(-7) == 490, "call of a call");
+	check(ilc_jit_sym(j, "square") == NULL, "local is not visible");
+	check(ilc_jit_sym(j, "nosuch") == NULL, "unknown name");
+	ilc_jit_free(j);
+}
+
+static void check_bad(struct ctx *c)
+{
+	int i, diags, lookups = 0;
+
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+		diags = c->diags_len;
+		check(ilc_jit_compile(c, bad[i].src, strlen(bad[i].src), lookup,
+				&lookups) == NULL && c->diags_len > diags, bad[i].what);
+	}
+}
+
+/* Perf map, that JIT writes for the process, is of no use after it */
+int main()
+{
+	struct ctx c;
+	char perf_map[32];
+
+	ctx_init(&c);
+	c.quiet = 1;
+	check_good(&c);
+	check_bad(&c);
+	ctx_free(&c);
+	snprintf(perf_map, sizeof(perf_map), "/tmp/perf-%d.map", (int)getpid());
+	unlink(perf_map);
+	return failed;
+}
@@ -0,0 +1,264 @@
+/*
+ * Lexer microbenchmark.
+ *
+ * Generates a large IL file and reports how many MB/s lexem_parse gets
+ * through it, next to the reference scanner below, which classifies
+ * symbols by a chain of comparisons, looks keywords up by strcmp and
+ * copies every name and number out of the input, as lexem_parse did
+ * before the table driven scanner.
+ *
+ *	make lexbench CFLAGS=-O2
+ *	bench/lexbench [<megabytes> [<runs>]]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "global.h"
+#include "input.h"
+#include "lparse.h"
+
+static const char *tmp_template = "/tmp/lexbench.XXXXXX";
+
+static void gen_file(FILE *f, long size);
+static double run_new(char *filename, int *count);
+static double run_ref(char *filename, int *count);
+
+int main(int argc, char **argv)
+{
+	long mb = argc > 1 ? atol(argv[1]) : 64;
+	int runs = argc > 2 ? atoi(argv[2]) : 5;
+	char filename[32];
+	double best_new = 0, best_ref = 0;
+	int cnt_new, cnt_ref;
+	int fd, i;
+	FILE *f;
+
+	strcpy(filename, tmp_template);
+	if ((fd = mkstemp(filename)) == -1 || (f = fdopen(fd, "w")) == NULL)
+		die("%s: can't create\n", filename);
+	gen_file(f, mb << 20);
+	fclose(f);
+
+	for (i = 0; i < runs; ++i) {
+		double t = run_ref(filename, &cnt_ref);
+		if (best_ref == 0 || t < best_ref)
+			best_ref = t;
+		t = run_new(filename, &cnt_new);
+		if (best_new == 0 || t < best_new)
+			best_new = t;
+	}
+	unlink(filename);
+
+	if (cnt_new != cnt_ref)
+		die("lexem count mismatch: %d vs %d\n", cnt_new, cnt_ref);
+	printf("input: %ld MB, %d lexems, best of %d runs\n", mb, cnt_new, runs);
+	printf("reference scanner: %8.1f MB/s\n", mb / best_ref);
+	printf("table scanner:     %8.1f MB/s\n", mb / best_new);
+	return 0;
+}
+
+static const char *cmds[] = {
+	"add", "sub", "mul", "umul", "div", "udiv", "rem", "urem"
+};
+
+static void gen_file(FILE *f, long size)
+{
+	long fnum;
+	int i;
+	for (fnum = 0; ftell(f) < size; ++fnum) {
+		fprintf(f, "%sfunc i $function_%ld(%%arg_0, %%arg_1, %%arg_2) {\n",
+				fnum % 2 ? "global\n" : "", fnum);
+		for (i = 0; i < 64; ++i) {
+			if (i % 8 == 7) {
+				fprintf(f, "\t%%tmp.%d = call $function_%ld(%%arg_0, %%tmp.%d,"
+						" %%arg_2)\n", i, fnum / 2, i - 1);
+			} else if (i % 8 == 0) {
+				fprintf(f, "\t%%tmp.%d = copy %d\n", i, (i - 32) * 1021);
+			} else {
+				fprintf(f, "\t%%tmp.%d = %s %%tmp.%d, %%arg_%d\n", i,
+						cmds[i % 8], i - 1, i % 3);
+			}
+		}
+		fprintf(f, "\tret %%tmp.63\n}\n\n");
+	}
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int ll_release(struct lexem_list *l)
+{
+	int count = ll_end(l) - ll_begin(l);
+	ll_free(l);
+	return count;
+}
+
+static double run_new(char *filename, int *count)
+{
+	double start = now();
+	struct lexem_list *l = lexem_parse(filename);
+	double res = now() - start;
+	*count = ll_release(l);
+	return res;
+}
+
+/* Reference scanner */
+
+enum {
+	ref_max_lexem_len = 32
+};
+
+struct ref_scanner {
+	char *p;
+	char *end;
+	struct coord cor;
+	int last_was_nl;
+};
+
+static inline void ref_pos_next(struct ref_scanner *sc, char c)
+{
+	if (sc->last_was_nl) {
+		++sc->cor.row;
+		sc->cor.col = 1;
+		sc->last_was_nl = 0;
+	} else {
+		++sc->cor.col;
+	}
+	if (c == '\n')
+		sc->last_was_nl = 1;
+}
+
+static inline int is_alpha(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline int is_number(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+#define REF_EAT(func_name, buf_pos, predicate, save_buf) \
+static void func_name(struct ref_scanner *sc, char *buffer) \
+{ \
+	int bufpos = buf_pos; \
+	for (; sc->p < sc->end; ++bufpos) { \
+		char c = *sc->p; \
+		if (!(predicate)) \
+			break; \
+		if (bufpos + 1 > ref_max_lexem_len) \
+			die("lexem too long\n"); \
+		ref_pos_next(sc, c); \
+		buffer[bufpos] = c; \
+		++sc->p; \
+	} \
+	buffer[bufpos] = 0; \
+	/* The copy used to live until remap */ \
+	if (save_buf) \
+		free(sstrdup(buffer)); \
+}
+
+REF_EAT(ref_eat_name, 1, is_alpha(c) || is_number(c), 0)
+REF_EAT(ref_eat_variable, 0, is_alpha(c) || is_number(c) || \
+		c == '_' || c == '.', 1)
+REF_EAT(ref_eat_number, 1, is_number(c), 1)
+REF_EAT(ref_eat_func_name, 0, is_alpha(c) || is_number(c) || c == '_', 1)
+
+static const struct {
+	char *str;
+	enum lexem_type lt;
+} ref_keywords[] = {
+	{ "func", lx_func_decl },
+	{ "i", lx_int_spec },
+	{ "call", lx_cmd_call },
+	{ "add", lx_cmd_add },
+	{ "sub", lx_cmd_sub },
+	{ "mul", lx_cmd_mul },
+	{ "umul", lx_cmd_umul },
+	{ "div", lx_cmd_div },
+	{ "udiv", lx_cmd_udiv },
+	{ "rem", lx_cmd_rem },
+	{ "urem", lx_cmd_urem },
+	{ "copy", lx_cmd_copy },
+	{ "ret", lx_cmd_ret },
+	{ "global", lx_global_spec }
+};
+
+static void ref_eat_lexem(struct ref_scanner *sc, char *buffer,
+		struct lexem_list *ll)
+{
+	struct lexem_block b;
+	int i;
+	b.crd = sc->cor;
+	if (buffer[0] == '\n') {
+		b.lt = lx_new_line;
+	} else if (is_alpha(buffer[0])) {
+		b.lt = lx_word;
+		ref_eat_name(sc, buffer);
+	} else if (buffer[0] == '(') {
+		b.lt = lx_parenleft;
+	} else if (buffer[0] == ')') {
+		b.lt = lx_parenright;
+	} else if (buffer[0] == ',') {
+		b.lt = lx_coma;
+	} else if (buffer[0] == '%') {
+		b.lt = lx_variable;
+		ref_eat_variable(sc, buffer);
+	} else if (buffer[0] == '{') {
+		b.lt = lx_open_brace;
+	} else if (buffer[0] == '}') {
+		b.lt = lx_close_brace;
+	} else if (is_number(buffer[0]) || buffer[0] == '-') {
+		b.lt = lx_number;
+		ref_eat_number(sc, buffer);
+	} else if (buffer[0] == '=') {
+		b.lt = lx_equal_sign;
+	} else if (buffer[0] == '$') {
+		b.lt = lx_global_name;
+		ref_eat_func_name(sc, buffer);
+	} else {
+		die("%d,%d: invalid symbol\n", sc->cor.row, sc->cor.col);
+	}
+	if (b.lt == lx_word) {
+		int n = sizeof(ref_keywords) / sizeof(ref_keywords[0]);
+		for (i = 0; i < n && strcmp(buffer, ref_keywords[i].str); ++i);
+		if (i == n)
+			die("[%d,%d]: unknown lexem\n", b.crd.row, b.crd.col);
+		b.lt = ref_keywords[i].lt;
+	}
+	ll_add(ll, &b);
+}
+
+static double run_ref(char *filename, int *count)
+{
+	double start = now();
+	struct lexem_list *l = ll_init();
+	struct input in;
+	struct ref_scanner sc = { NULL, NULL, { 1, 0 }, 0 };
+	double res;
+
+	input_open(&in, filename);
+	sc.p = in.data;
+	sc.end = in.data + in.len;
+	while (sc.p < sc.end) {
+		char buffer[ref_max_lexem_len + 1];
+		char c = *sc.p++;
+		ref_pos_next(&sc, c);
+		if (c == ' ' || c == '\t')
+			continue;
+		buffer[0] = c;
+		ref_eat_lexem(&sc, buffer, l);
+	}
+	input_close(&in);
+	res = now() - start;
+	*count = ll_release(l);
+	return res;
+}
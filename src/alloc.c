@@ -6,13 +6,10 @@
 #include "global.h"
 #include "func.h"
 #include "alloc.h"
+#include "arena.h"
 
 typedef unsigned long long ulonglong;
 
-enum {
-	dbg_heapsort = 0
-};
-
 static const char *reg_names[] = {
 	"rdi",
 	"rsi",
@@ -22,12 +19,12 @@ static const char *reg_names[] = {
 	"r9",
 	"rbx",
 	"r10",
-	"r11",
+	"rax",
 	"r12",
 	"r13",
 	"r14",
 	"r15",
-	"rax",
+	"r11",
 	"rsp",
 	"rbp"
 };
@@ -36,12 +33,23 @@ struct lifespan {
 	unsigned int id;
 	unsigned int start;
 	unsigned int end;
+	int uses;		/* commands, that refer to the variable */
 };
 
 struct lifes {
 	struct lifespan *vec;
 	int len;
 	int pos;
+	int *calls;		/* by position: number of calls up to it */
+	int *call_pos;	/* positions of calls */
+	int calls_len;
+	int *fixed;		/* by position: number of commands with fixed registers */
+	int *use_first;	/* by variable: its positions in use_pos */
+	int *use_pos;	/* positions of commands, that refer to variables */
+	char *use_def;	/* by use: command assigns the variable */
+	int *use_next;	/* by variable: first of them not passed yet */
+	int *copy_of;	/* by variable: copy source, that dies there, or -1 */
+	int *hint;		/* by variable: register, that saves moves, or -1 */
 };
 
 typedef int(*cmpfunc)(struct lifespan *a, struct lifespan *b);
@@ -51,73 +59,96 @@ static inline int memval(int val)
 	return mem + val;
 }
 
-static void alloc_init(struct alloc *a, int num);
-static void lifes_fill(struct lifes *ls, int num);
-static void lifes_free(struct lifes *l);
+static void alloc_init(struct alloc *a, int num, struct arena *ar);
+static void lifes_fill(struct lifes *ls, int num, struct arena *ar);
 static void calc_lifespan(struct cmd_list *cl, int fargs, int num,
 		struct lifes *ls);
-static void lifes_copy(struct lifes *dest, struct lifes *src);
+static void calls_fill(struct lifes *ls, struct cmd_list *cl,
+		struct arena *ar);
+static void uses_fill(struct lifes *ls, struct cmd_list *cl,
+		struct arena *ar);
+static void copies_fill(struct lifes *ls, struct cmd_list *cl,
+		struct arena *ar);
+static void hints_fill(struct lifes *ls, struct cmd_list *cl,
+		struct arena *ar);
+static void lifes_copy(struct lifes *dest, struct lifes *src,
+		struct arena *ar);
 static void debug_lifespan(struct lifes *ls, struct var_sym_tbl *tb);
 static int cmp_for_bystart_smaller(struct lifespan *a, struct lifespan *b);
 static int cmp_for_byend_smaller(struct lifespan *a, struct  lifespan *b);
 static void heapsort(struct lifes *l, cmpfunc f);
 static void real_alloc(struct alloc *a, struct lifes *l);
+static void graph_alloc(struct alloc *a, struct lifes *l, int argnum);
+static void alloc_stats(struct alloc *a, struct cmd_list *cl);
+static void slots_share(struct alloc *a, struct lifes *l);
+static void args_fix(struct alloc *a);
+static void frame_align(struct alloc *a, struct lifes *l);
+static void across_fill(struct alloc *a, struct lifes *l);
 static void debug_allocation(struct alloc *a, struct var_sym_tbl *tb);
+static void debug_frame(struct alloc *a, char *name);
 
 struct alloc *allocate(struct function *f)
 {
-	struct alloc *ac = smalloc(sizeof(struct alloc));
+	struct alloc *ac = arena_alloc(&f->ar, sizeof(struct alloc));
 	struct lifes l;
 
-	alloc_init(ac, f->stb.len);
-	lifes_fill(&l, f->stb.len);
+	alloc_init(ac, f->stb.len, &f->ar);
+	lifes_fill(&l, f->stb.len, &f->ar);
 
 	calc_lifespan(f->cl, f->argnum, f->stb.len, &l);
+	calls_fill(&l, f->cl, &f->ar);
+	copies_fill(&l, f->cl, &f->ar);
+	hints_fill(&l, f->cl, &f->ar);
 	debug_lifespan(&l, &f->stb);
 
-	real_alloc(ac, &l);
-	lifes_free(&l);
+	if (ctx_cur->regalloc == regalloc_graph)
+		graph_alloc(ac, &l, f->argnum);
+	else {
+		uses_fill(&l, f->cl, &f->ar);
+		real_alloc(ac, &l);
+	}
+	slots_share(ac, &l);
+	args_fix(ac);
+	across_fill(ac, &l);
+	frame_align(ac, &l);
 	debug_allocation(ac, &f->stb);
+	debug_frame(ac, f->name);
+	if (ctx_cur->time_report)
+		alloc_stats(ac, f->cl);
 	return ac;
 }
 
-void alloc_init(struct alloc *a, int num)
+void alloc_init(struct alloc *a, int num, struct arena *ar)
 {
 	int i;
-	a->vec = smalloc(num * sizeof(struct var_state));
+	a->vec = arena_alloc(ar, num * sizeof(struct var_state));
+	a->ar = ar;
 	a->len = num;
 	a->st_offset = 0;
+	a->saved = 0;
+	a->across = NULL;
+	a->call_next = 0;
+	a->spills = NULL;
+	a->slots = 0;
+	a->shared = 0;
 	for (i = 0; i < num; ++i) {
 		a->vec[i].curr = a->vec[i].last = NULL;
 	}
 }
 
-void alloc_free(struct alloc *a)
-{
-	int i;
-	for (i = 0; i < a->len; ++i)
-			free(a->vec[i].curr);
-	free(a->vec);
-	free(a);
-}
-
-static void lifes_fill(struct lifes *ls, int num)
+static void lifes_fill(struct lifes *ls, int num, struct arena *ar)
 {
 	int i;
 	ls->len = num;
 	ls->pos = 0;
-	ls->vec = smalloc(num * sizeof(struct lifespan));
+	ls->vec = arena_alloc(ar, num * sizeof(struct lifespan));
 	for (i = 0; i < num; ++i) {
 		ls->vec[i].id = i;
 		ls->vec[i].end = ls->vec[i].start = UINT_MAX;
+		ls->vec[i].uses = 0;
 	}
 }
 
-static void lifes_free(struct lifes *l)
-{
-	free(l->vec);
-}
-
 static void process_args(struct lifes *ls, int pos,
 		struct cmd_unit *args, int anum);
 static void process_ret(struct lifes *ls, int pos, struct cmd_unit *ret);
@@ -151,6 +182,7 @@ static void process_args(struct lifes *ls, int pos,
 				span->end = span->start = pos;
 			else
 				span->end = pos;
+			++span->uses;
 		}
 	}
 }
@@ -162,13 +194,176 @@ static void process_ret(struct lifes *ls, int pos, struct cmd_unit *ret)
 		span->end = span->start = pos;
 	else
 		span->end = pos;
+	++span->uses;
+}
+
+/* Multiplication and division take rax and rdx, see il_muldiv of emit.c */
+static int is_fixed(int type)
+{
+	return type >= cmd_mul && type <= cmd_urem;
+}
+
+static void calls_fill(struct lifes *ls, struct cmd_list *cl,
+		struct arena *ar)
+{
+	struct cmd_list_el *tmp;
+	int i, len = 0;
+
+	for (tmp = cl->first; tmp; tmp = tmp->next)
+		++len;
+	ls->calls = arena_alloc(ar, (len + 1) * sizeof(int));
+	ls->call_pos = arena_alloc(ar, (len + 1) * sizeof(int));
+	ls->fixed = arena_alloc(ar, (len + 1) * sizeof(int));
+	ls->calls_len = 0;
+	ls->calls[0] = ls->fixed[0] = 0;
+	for (tmp = cl->first, i = 1; tmp; tmp = tmp->next, ++i) {
+		if (tmp->cmd.type == cmd_call)
+			ls->call_pos[ls->calls_len++] = i;
+		ls->calls[i] = ls->calls_len;
+		ls->fixed[i] = ls->fixed[i - 1] + is_fixed(tmp->cmd.type);
+	}
+}
+
+static void use_add(struct lifes *ls, int pos, struct cmd_unit *u, int def)
+{
+	if (u->type == 'i') {
+		ls->use_def[ls->use_next[u->id]] = def;
+		ls->use_pos[ls->use_next[u->id]++] = pos;
+	}
+}
+
+/* Positions of uses of every variable in ascending order */
+static void uses_fill(struct lifes *ls, struct cmd_list *cl,
+		struct arena *ar)
+{
+	struct cmd_list_el *tmp;
+	int i, pos;
+
+	ls->use_first = arena_alloc(ar, (ls->len + 1) * sizeof(int));
+	ls->use_next = arena_alloc(ar, ls->len * sizeof(int));
+	ls->use_first[0] = 0;
+	for (i = 0; i < ls->len; ++i)
+		ls->use_first[i + 1] = ls->use_first[i] + ls->vec[i].uses;
+	ls->use_pos = arena_alloc(ar, (ls->use_first[ls->len] + 1) * sizeof(int));
+	ls->use_def = arena_alloc(ar, ls->use_first[ls->len] + 1);
+	memcpy(ls->use_next, ls->use_first, ls->len * sizeof(int));
+	for (tmp = cl->first, pos = 1; tmp; tmp = tmp->next, ++pos) {
+		for (i = 0; i < tmp->cmd.argnum; ++i)
+			use_add(ls, pos, tmp->cmd.args + i, 0);
+		use_add(ls, pos, &tmp->cmd.ret_var, 1);
+	}
+	memcpy(ls->use_next, ls->use_first, ls->len * sizeof(int));
+}
+
+/* First use of the variable at pos or after it. Pos must not decrease */
+static int next_use(struct lifes *ls, int var, int pos)
+{
+	int *i = ls->use_next + var;
+	for (; *i < ls->use_first[var + 1] && ls->use_pos[*i] < pos; ++*i);
+	return *i < ls->use_first[var + 1] ? ls->use_pos[*i] : INT_MAX;
+}
+
+/*
+ * Variable, that a copy starts, may take place of its source, if the
+ * source dies there: they are alive together only at the copy and have
+ * the same value then.
+ */
+static void copies_fill(struct lifes *ls, struct cmd_list *cl,
+		struct arena *ar)
+{
+	struct cmd_list_el *tmp;
+	int i, pos;
+
+	ls->copy_of = arena_alloc(ar, (ls->len + 1) * sizeof(int));
+	for (i = 0; i < ls->len; ++i)
+		ls->copy_of[i] = -1;
+	for (tmp = cl->first, pos = 1; tmp; tmp = tmp->next, ++pos) {
+		struct cmd_unit *src = tmp->cmd.args, *dest = &tmp->cmd.ret_var;
+		if (tmp->cmd.type != cmd_copy || src->type != 'i' ||
+				dest->type != 'i' || src->id == dest->id)
+			continue;
+		if (ls->vec[src->id].end == pos && ls->vec[dest->id].start == pos)
+			ls->copy_of[dest->id] = src->id;
+	}
+}
+
+static void hint_set(struct lifes *ls, struct cmd_unit *u, int reg, int pos)
+{
+	if (u->type != 'i')
+		return;
+	if (ls->vec[u->id].end == pos || ls->hint[u->id] == -1)
+		ls->hint[u->id] = reg;
+}
+
+/*
+ * Registers, that commands want operands and results in: rdi..r9 for
+ * arguments of calls, rax for results of calls, ret and multiplication,
+ * rdx for remainder. Use, that the variable dies at, wins over the rest.
+ */
+static void hints_fill(struct lifes *ls, struct cmd_list *cl,
+		struct arena *ar)
+{
+	struct cmd_list_el *tmp;
+	int i, pos;
+
+	ls->hint = arena_alloc(ar, (ls->len + 1) * sizeof(int));
+	for (i = 0; i < ls->len; ++i)
+		ls->hint[i] = -1;
+	for (tmp = cl->first, pos = 1; tmp; tmp = tmp->next, ++pos) {
+		struct command *c = &tmp->cmd;
+		if (c->type == cmd_call) {
+			for (i = 1; i < c->argnum && i <= 6; ++i)
+				hint_set(ls, c->args + i, i - 1, pos);
+			hint_set(ls, &c->ret_var, rax, pos);
+		} else if (c->type == cmd_ret && c->argnum == 1) {
+			hint_set(ls, c->args, rax, pos);
+		} else if (is_fixed(c->type)) {
+			hint_set(ls, c->args, rax, pos);
+			hint_set(ls, &c->ret_var, c->type == cmd_rem ||
+					c->type == cmd_urem ? rdx : rax, pos);
+		}
+	}
+}
+
+/* Variable is not assigned from start up to the passed uses */
+static int unchanged_since(struct lifes *ls, int var, int start)
+{
+	int i = ls->use_next[var] - 1;
+	for (; i >= ls->use_first[var] && ls->use_pos[i] >= start; --i) {
+		if (ls->use_def[i])
+			return 0;
+	}
+	return 1;
 }
 
-static void lifes_copy(struct lifes *dest, struct lifes *src)
+/* There is a call, after which value of the variable is still needed */
+static int lives_across(struct lifes *ls, struct lifespan *span)
+{
+	if (span->start == UINT_MAX || span->end <= span->start + 1)
+		return 0;
+	return ls->calls[span->end - 1] > ls->calls[span->start];
+}
+
+/*
+ * Variable, that is in a register from position from on, must not be in
+ * rax or rdx, if multiplication or division is done meanwhile and the
+ * variable is needed after it. Returns mask of such registers.
+ */
+static int fixed_clobbers(struct lifes *ls, struct lifespan *span, int from)
+{
+	int lo = MAX(from, (int)span->start + 1);
+	if (span->start == UINT_MAX || (int)span->end - 1 < lo)
+		return 0;
+	return ls->fixed[span->end - 1] > ls->fixed[lo - 1] ?
+		1 << rax | 1 << rdx : 0;
+}
+
+static void lifes_copy(struct lifes *dest, struct lifes *src,
+		struct arena *ar)
 {
 	int i;
 	*dest = *src;
-	dest->vec = smalloc(dest->len * sizeof(struct lifespan));
+	dest->vec = arena_alloc(ar, dest->len * sizeof(struct lifespan));
 	for (i = 0; i < dest->len; ++i)
 		dest->vec[i] = src->vec[i];
 }
@@ -176,11 +371,11 @@ static void lifes_copy(struct lifes *dest, struct lifes *src)
 static void debug_lifespan(struct lifes *ls, struct var_sym_tbl *tb)
 {
 	int i;
-	if (dbg_lifespan == 0)
+	if (DBG(lifespan) == 0)
 		return;
-	eprintf("\n--Lifespan--\n");
+	dbg_printf("\n--Lifespan--\n");
 	for (i = 0; i < ls->len; ++i) {
-		eprintf("\t\'%s\': %d - %d\n", tb->vec[i].name,
+		dbg_printf("\t\'%s\': %d - %d\n", tb->vec[i].name,
 				ls->vec[i].start, ls->vec[i].end);
 	}
 }
@@ -233,21 +428,22 @@ static void heapsort(struct lifes *l, cmpfunc f)
 		l->vec[0] = tmp;
 		heapify(l->vec, i, 0, f);
 	}
-	if (dbg_heapsort)
+	if (DBG(heapsort))
 		dbg_int_heapsort(l->vec, l->len);
 }
 
 static void dbg_int_heapsort(struct lifespan *l, int len)
 {
 	int i;
-	eprintf("---Heapsort---\n");
+	dbg_printf("---Heapsort---\n");
 	for (i = 0; i < len; ++i)
-		eprintf("\t%d: %d, %d\n", l[i].id, l[i].start, l[i].end);
+		dbg_printf("\t%d: %d, %d\n", l[i].id, l[i].start, l[i].end);
 }
 
 struct reg_stack {
 	int pointer;
 	char stack[registers_number];
+	int owner[registers_number];	/* variable in register or -1 */
 };
 
 struct deprived_unit {
@@ -260,19 +456,22 @@ struct deprived_unit {
 struct deprived_deque {
 	struct deprived_unit *first;
 	struct deprived_unit *last;
+	struct arena *ar;
 };
 
 static void rstack_init(struct reg_stack *s);
 static void rstack_add(struct reg_stack *s, int reg);
 static int rstack_get(struct reg_stack *s);
+static int rstack_take(struct reg_stack *s, struct lifes *tbl, int var,
+		int from);
 
 void alloc_ins_var_state(struct alloc *a, int var, int value,
 		int start, int end);
 
 static int deprd_fget(struct deprived_deque *d);
-static int deprd_bget(struct deprived_deque *d);
+static int deprd_take(struct deprived_deque *d, struct lifes *tbl,
+		int pos);
 static void deprd_ins(struct deprived_deque *d, struct lifespan *l);
-static void deprd_free(struct deprived_deque *d);
 
 static const ulonglong bystart_mark = 1ULL << 63;
 static const ulonglong byend_mark = 1ULL << 62;
@@ -284,20 +483,45 @@ static void discard_inneed_dead(struct deprived_deque *dq, int start);
 static void	discard_dead(struct lifes *l, int start,
 		struct alloc *a, struct reg_stack *rs);
 static void alloc_var(struct lifes *l, struct alloc *a, int *offset,
-		struct reg_stack *rs, struct deprived_deque *d, int start);
+		struct reg_stack *rs, struct deprived_deque *d, int start,
+		struct lifes *tbl);
 static void give_to_in_need(struct deprived_deque *d, int start,
 		struct reg_stack *rs, struct alloc *a, struct lifes *tbl);
+static int home_slot(struct alloc *a, int var, int *offset);
+static void spill_add(struct alloc *a, int pos, int var, int clean);
+
+static void spill_add(struct alloc *a, int pos, int var, int clean)
+{
+	struct alloc_spill *s = arena_alloc(a->ar, sizeof(struct alloc_spill));
+	s->pos = pos;
+	s->var = var;
+	s->clean = clean;
+	s->next = a->spills;
+	a->spills = s;
+}
+
+/* Evictions are prepended, emitter takes them in order of positions */
+static void spills_reverse(struct alloc *a)
+{
+	struct alloc_spill *s = a->spills, *res = NULL, *tmp;
+	for (; s; s = tmp) {
+		tmp = s->next;
+		s->next = res;
+		res = s;
+	}
+	a->spills = res;
+}
 
 static void real_alloc(struct alloc *a, struct lifes *l)
 {
 	struct reg_stack rs;
 	ulonglong pos;
-	struct deprived_deque dq = { NULL, NULL };
+	struct deprived_deque dq = { NULL, NULL, a->ar };
 	struct lifes bystart;
 	struct lifes byend;
 
-	lifes_copy(&bystart, l);
-	lifes_copy(&byend, l);
+	lifes_copy(&bystart, l, a->ar);
+	lifes_copy(&byend, l, a->ar);
 	heapsort(&bystart, cmp_for_bystart_smaller);
 	heapsort(&byend, cmp_for_byend_smaller);
 
@@ -311,13 +535,11 @@ static void real_alloc(struct alloc *a, struct lifes *l)
 			discard_dead(&byend, pos, a, &rs);
 
 		if (pos & bystart_mark)
-			alloc_var(&bystart, a, &a->st_offset, &rs, &dq, pos);
+			alloc_var(&bystart, a, &a->st_offset, &rs, &dq, pos, l);
 
 		give_to_in_need(&dq, pos, &rs, a, l);
 	}
-	lifes_free(&bystart);
-	lifes_free(&byend);
-	deprd_free(&dq);
+	spills_reverse(a);
 }
 
 static ulonglong getpos(struct lifes *bystart, struct lifes *byend)
@@ -344,21 +566,48 @@ static ulonglong getpos(struct lifes *bystart, struct lifes *byend)
 	return min;
 }
 
+/*
+ * Argument, that comes in rdx, leaves it before the first command, if
+ * multiplication or division needs rdx, while the argument is alive.
+ */
+static void arg_leave(struct alloc *a, struct reg_stack *rs,
+		struct lifes *tbl, struct deprived_deque *d, int var)
+{
+	int reg = rstack_take(rs, tbl, var, 1);
+
+	a->vec[var].last->end = 0;
+	if (reg != -1) {
+		alloc_ins_var_state(a, var, reg, 1, tbl->vec[var].end);
+		rs->owner[reg] = var;
+	} else {
+		alloc_ins_var_state(a, var, home_slot(a, var, &a->st_offset),
+				1, tbl->vec[var].end);
+		deprd_ins(d, tbl->vec + var);
+	}
+	spill_add(a, 1, var, 0);
+	rstack_add(rs, var);
+}
+
 static int resolve_args(struct alloc *a, struct reg_stack *rs,
 		struct lifes *tbl, struct deprived_deque *d)
 {
 	int offset = 8;
-	int i;
+	int i, j;
 	for (i = 0; i < tbl->len && tbl->vec[i].start == 0; ++i) {
 		int reg;
 		if (i < 6 && (reg = rstack_get(rs)) != -1) {
 			alloc_ins_var_state(a, i, reg, 0, tbl->vec[i].end);
+			rs->owner[reg] = i;
 		} else {
 			alloc_ins_var_state(a, i, memval(offset += 8),
 					0, tbl->vec[i].end);
 			deprd_ins(d, tbl->vec + i);
 		}
 	}
+	for (j = 0; j < i && j < 6; ++j) {
+		if (fixed_clobbers(tbl, tbl->vec + j, 1) & 1 << j)
+			arg_leave(a, rs, tbl, d, j);
+	}
 	return i;
 }
 
@@ -373,27 +622,122 @@ static void	discard_dead(struct lifes *l, int start,
 		struct alloc *a, struct reg_stack *rs)
 {
 	for (; l->pos < l->len && l->vec[l->pos].end < start; ++l->pos) {
-		if (a->vec[l->vec[l->pos].id].last->stid < 1000)
-			rstack_add(rs, a->vec[l->vec[l->pos].id].last->stid);
+		int id = l->vec[l->pos].id;
+		int stid = a->vec[id].last->stid;
+		if (is_reg(stid) && rs->owner[stid] == id)
+			rstack_add(rs, stid);
+	}
+}
+
+/* Variable keeps the first stack slot, it gets, for all its life */
+static int home_slot(struct alloc *a, int var, int *offset)
+{
+	struct alloc_phase *p = a->vec[var].curr;
+	for (; p; p = p->next) {
+		if (is_mem(p->stid))
+			return p->stid;
+	}
+	return memval(*offset -= 8);
+}
+
+/* Less uses per position of life */
+static int sparser(struct lifespan *x, struct lifespan *y)
+{
+	return (long long)x->uses * (y->end - y->start + 1) <
+		(long long)y->uses * (x->end - x->start + 1);
+}
+
+/*
+ * Of the variables in registers and span, that starts at pos, the one,
+ * that is used next the furthest, goes to memory, of equal ones the
+ * sparser does. Variables, that the command at pos refers to, stay.
+ * Returns register to take from its variable or -1, if span goes itself.
+ */
+static int evict_choose(struct lifes *tbl, struct alloc *a,
+		struct reg_stack *rs, struct lifespan *span, int pos)
+{
+	struct lifespan *best = span;
+	int far = next_use(tbl, span->id, pos + 1);
+	int forbid = fixed_clobbers(tbl, span, pos);
+	int reg, res = -1;
+
+	for (reg = 0; reg < registers_number; ++reg) {
+		int id = rs->owner[reg];
+		int next;
+		if (id == -1 || a->vec[id].last->start == pos || forbid & 1 << reg)
+			continue;
+		next = next_use(tbl, id, pos);
+		if (next == pos)
+			continue;
+		if (next > far || (next == far && sparser(tbl->vec + id, best))) {
+			far = next;
+			best = tbl->vec + id;
+			res = reg;
+		}
 	}
+	return res;
+}
+
+/*
+ * Emitter stores var before the command at pos, register is not its then.
+ * Store is not needed, if var was loaded from its slot and not assigned.
+ */
+static void evict(struct lifes *tbl, struct alloc *a, int var, int *offset,
+		struct deprived_deque *d, int pos)
+{
+	struct alloc_phase *p = a->vec[var].last, *q = a->vec[var].curr;
+	int slot = home_slot(a, var, offset);
+	int clean;
+
+	for (; q != p && q->next != p; q = q->next);
+	clean = q != p && is_mem(q->stid) && unchanged_since(tbl, var, p->start);
+
+	p->end = pos - 1;
+	alloc_ins_var_state(a, var, slot, pos, tbl->vec[var].end);
+	deprd_ins(d, tbl->vec + var);
+	spill_add(a, pos, var, clean);
+}
+
+/* Register of the copy source, that dies at the start of var, is a hint */
+static int copy_reg(struct lifes *tbl, struct alloc *a, struct reg_stack *rs,
+		int var)
+{
+	int src = tbl->copy_of[var];
+	int stid;
+
+	if (src == -1)
+		return -1;
+	stid = a->vec[src].last->stid;
+	if (is_reg(stid) && rs->owner[stid] == src &&
+			!(fixed_clobbers(tbl, tbl->vec + var, 0) & 1 << stid))
+		return stid;
+	return -1;
 }
 
 static void alloc_var(struct lifes *l, struct alloc *a, int *offset,
-		struct reg_stack *rs, struct deprived_deque *d, int start)
+		struct reg_stack *rs, struct deprived_deque *d, int start,
+		struct lifes *tbl)
 {
 	for (; l->pos < l->len && l->vec[l->pos].start == start; ++l->pos) {
 		struct lifespan *tmp = l->vec + l->pos;
-		int reg = rstack_get(rs);
+		int reg = copy_reg(tbl, a, rs, tmp->id);
+		if (reg == -1)
+			reg = rstack_take(rs, tbl, tmp->id, start);
+		if (reg == -1 &&
+				(reg = evict_choose(tbl, a, rs, tmp, start)) != -1)
+			evict(tbl, a, rs->owner[reg], offset, d, start);
 		if (reg != -1) {
 			alloc_ins_var_state(a, tmp->id, reg, start, tmp->end);
+			rs->owner[reg] = tmp->id;
 		} else {
-			alloc_ins_var_state(a, tmp->id, memval(*offset -= 8),
+			alloc_ins_var_state(a, tmp->id, home_slot(a, tmp->id, offset),
 					start, tmp->end);
 			deprd_ins(d, tmp);
 		}
 	}
 }
 
+/* Freed register goes to the variable in memory, that is used next */
 static void give_to_in_need(struct deprived_deque *d, int start,
 		struct reg_stack *rs, struct alloc *a, struct lifes *tbl)
 {
@@ -403,11 +747,17 @@ static void give_to_in_need(struct deprived_deque *d, int start,
 	if (d->first == NULL || rs->pointer == -1)
 		return;
 
-	id = deprd_bget(d);
-	reg = rstack_get(rs);
+	id = deprd_take(d, tbl, start);
+	reg = rstack_take(rs, tbl, id, start);
+	if (reg == -1) {
+		give_to_in_need(d, start, rs, a, tbl);
+		deprd_ins(d, tbl->vec + id);
+		return;
+	}
 
-	a->vec[id].curr->end = start - 1;
+	a->vec[id].last->end = start - 1;
 	alloc_ins_var_state(a, id, reg, start, tbl->vec[id].end);
+	rs->owner[reg] = id;
 	give_to_in_need(d, start, rs, a, tbl);
 }
 
@@ -424,6 +774,7 @@ static void rstack_add(struct reg_stack *s, int reg)
 	if (s->pointer == registers_number - 1)
 		die("internal error\n");
 	s->stack[++s->pointer] = reg;
+	s->owner[reg] = -1;
 }
 
 static int rstack_get(struct reg_stack *s)
@@ -433,11 +784,46 @@ static int rstack_get(struct reg_stack *s)
 	return s->stack[s->pointer--];
 }
 
+/*
+ * Register for var from position from on. Hinted one is taken, if it is
+ * free, else with -fcallee-saved variable, that lives across a call, gets
+ * callee-saved register, if there is one, so that the call need not save
+ * it. Registers of fixed_clobbers are not given.
+ */
+static int rstack_take(struct reg_stack *s, struct lifes *tbl, int var,
+		int from)
+{
+	struct lifespan *span = tbl->vec + var;
+	int forbid = fixed_clobbers(tbl, span, from);
+	int callee_saved = ctx_cur->callee_saved && lives_across(tbl, span);
+	int i, reg, best = -1;
+
+	for (i = s->pointer; i >= 0; --i) {
+		reg = s->stack[i];
+		if (forbid & 1 << reg)
+			continue;
+		if (reg == tbl->hint[var]) {
+			best = i;
+			break;
+		}
+		if (best == -1 || (callee_saved && is_callee_saved(reg) &&
+					!is_callee_saved(s->stack[best])))
+			best = i;
+	}
+	if (best == -1)
+		return -1;
+	reg = s->stack[best];
+	for (i = best; i < s->pointer; ++i)
+		s->stack[i] = s->stack[i + 1];
+	--s->pointer;
+	return reg;
+}
+
 void alloc_ins_var_state(struct alloc *a, int var, int value,
 		int start, int end)
 {
 	struct var_state *vs = a->vec + var;
-	struct alloc_phase *tmp = smalloc(sizeof(struct alloc_phase));
+	struct alloc_phase *tmp = arena_alloc(a->ar, sizeof(struct alloc_phase));
 	tmp->start = start;
 	tmp->end = end;
 	tmp->next = NULL;
@@ -446,6 +832,127 @@ void alloc_ins_var_state(struct alloc *a, int var, int value,
 	else
 		vs->last = vs->last->next = tmp;
 	tmp->stid = value;
+	if (is_reg(value) && is_callee_saved(value))
+		a->saved |= 1 << value;
+}
+
+/*
+ * Arguments on stack are addressed as if only rbp was pushed above them.
+ * emit_head pushes the callee-saved registers, that are used, too.
+ */
+static void args_fix(struct alloc *a)
+{
+	int shift = 8 * __builtin_popcount(a->saved);
+	int i;
+	struct alloc_phase *p;
+
+	if (shift == 0)
+		return;
+	for (i = 0; i < a->len; ++i) {
+		for (p = a->vec[i].curr; p; p = p->next) {
+			if (is_mem(p->stid) && p->stid > mem)
+				p->stid += shift;
+		}
+	}
+}
+
+/*
+ * Variables, that are not on stack at once, share a slot. Slot is busy
+ * from the first phase in it up to the end of its variables: clean
+ * evictions and lazy loads rely on the value there. Spans of slots are
+ * intervals, so taking a freed slot in order of starts needs the least of
+ * them, as in real_alloc.
+ */
+static void slots_share(struct alloc *a, struct lifes *l)
+{
+	struct lifes bystart, byend;
+	struct alloc_phase *p;
+	int n = -a->st_offset / 8;
+	int *color, *free_slots;
+	int i, j, k, len = 0, free_len = 0;
+
+	a->slots = n;
+	if (n < 2)
+		return;
+	bystart.vec = arena_alloc(a->ar, n * sizeof(struct lifespan));
+	bystart.len = n;
+	for (k = 0; k < n; ++k) {
+		bystart.vec[k].id = k;
+		bystart.vec[k].start = UINT_MAX;
+		bystart.vec[k].end = 0;
+		bystart.vec[k].uses = 0;
+	}
+	for (i = 0; i < a->len; ++i) {
+		for (p = a->vec[i].curr; p; p = p->next) {
+			struct lifespan *s;
+			if (!is_mem(p->stid) || p->stid >= mem)
+				continue;
+			s = bystart.vec + (mem - p->stid) / 8 - 1;
+			s->start = MIN(s->start, (unsigned int)p->start);
+			s->end = MAX(s->end, l->vec[i].end);
+		}
+	}
+	lifes_copy(&byend, &bystart, a->ar);
+	heapsort(&bystart, cmp_for_bystart_smaller);
+	heapsort(&byend, cmp_for_byend_smaller);
+
+	color = arena_alloc(a->ar, n * sizeof(int));
+	free_slots = arena_alloc(a->ar, n * sizeof(int));
+	for (k = 0; k < n; ++k)
+		color[k] = -1;
+	for (i = j = 0; i < n && bystart.vec[i].start != UINT_MAX; ++i) {
+		for (; byend.vec[j].end < bystart.vec[i].start; ++j) {
+			if (color[byend.vec[j].id] != -1)
+				free_slots[free_len++] = color[byend.vec[j].id];
+		}
+		color[bystart.vec[i].id] = free_len ? free_slots[--free_len] : len++;
+	}
+
+	for (i = 0; i < a->len; ++i) {
+		for (p = a->vec[i].curr; p; p = p->next) {
+			if (is_mem(p->stid) && p->stid < mem)
+				p->stid = memval(-8 * (color[(mem - p->stid) / 8 - 1] + 1));
+		}
+	}
+	a->st_offset = -8 * len;
+	a->shared = n - len;
+}
+
+/*
+ * Return address, saved registers and variables take multiple of 16
+ * bytes, so that emit_ccall may align rsp at calls.
+ */
+static void frame_align(struct alloc *a, struct lifes *l)
+{
+	if (l->calls_len && (__builtin_popcount(a->saved) - a->st_offset / 8) % 2)
+		a->st_offset -= 8;
+}
+
+/*
+ * Caller-saved register must be saved around a call, if a variable is in
+ * it at the call and is used after it. Variables, that the call defines or
+ * uses for the last time, are not.
+ */
+static void across_fill(struct alloc *a, struct lifes *l)
+{
+	int i, k;
+	struct alloc_phase *p;
+
+	a->across = arena_alloc(a->ar, (l->calls_len + 1) * sizeof(int));
+	memset(a->across, 0, (l->calls_len + 1) * sizeof(int));
+	for (i = 0; i < a->len; ++i) {
+		struct lifespan *span = l->vec + i;
+		if (lives_across(l, span) == 0)
+			continue;
+		for (p = a->vec[i].curr; p; p = p->next) {
+			int lo = MAX(p->start, (int)span->start + 1);
+			int hi = MIN(p->end, (int)span->end - 1);
+			if (is_mem(p->stid) || is_callee_saved(p->stid) || lo > hi)
+				continue;
+			for (k = l->calls[lo - 1]; k < l->calls[hi]; ++k)
+				a->across[k] |= 1 << p->stid;
+		}
+	}
 }
 
 static int deprd_fget(struct deprived_deque *d)
@@ -462,31 +969,39 @@ static int deprd_fget(struct deprived_deque *d)
 	res = tmp->id;
 	if (d->first)
 		d->first->prev = NULL;
-	free(tmp);
 	return res;
 }
 
-static int deprd_bget(struct deprived_deque *d)
+/* Takes the one used the soonest after pos, of equal ones the denser */
+static int deprd_take(struct deprived_deque *d, struct lifes *tbl, int pos)
 {
-	struct deprived_unit *tmp;
-	int res;
-	if (d->first == NULL)
-		return -1;
-	if (d->first == d->last)
-		d->first = NULL;
-	tmp = d->last;
-	d->last = d->last->prev;
-	res = tmp->id;
-	if (d->last)
-		d->last->next = NULL;
-	free(tmp);
-	return res;
+	struct deprived_unit *tmp, *best = NULL;
+	int near = INT_MAX;
+
+	for (tmp = d->first; tmp; tmp = tmp->next) {
+		int next = next_use(tbl, tmp->id, pos);
+		if (best == NULL || next < near || (next == near &&
+				sparser(tbl->vec + best->id, tbl->vec + tmp->id))) {
+			near = next;
+			best = tmp;
+		}
+	}
+	if (best->prev)
+		best->prev->next = best->next;
+	else
+		d->first = best->next;
+	if (best->next)
+		best->next->prev = best->prev;
+	else
+		d->last = best->prev;
+	return best->id;
 }
 
 static void deprd_ins(struct deprived_deque *d, struct lifespan *l)
 {
 	struct deprived_unit *tmp = d->last;
-	struct deprived_unit *tmp2 = smalloc(sizeof(struct deprived_unit));
+	struct deprived_unit *tmp2 = arena_alloc(d->ar,
+			sizeof(struct deprived_unit));
 	tmp2->id = l->id;
 	tmp2->end = l->end;
 
@@ -498,6 +1013,7 @@ static void deprd_ins(struct deprived_deque *d, struct lifespan *l)
 			d->first->prev = d->first->next = NULL;
 		} else {
 			d->first->prev = tmp2;
+			tmp2->prev = NULL;
 			tmp2->next = d->first;
 			d->first = tmp2;
 		}
@@ -512,13 +1028,531 @@ static void deprd_ins(struct deprived_deque *d, struct lifespan *l)
 	}
 }
 
-static void deprd_free(struct deprived_deque *d)
+static struct alloc_phase *phase_at(struct alloc *a, int var, int pos)
 {
-	struct deprived_unit *tmp;
-	while (d->first) {
-		tmp = d->first;
-		d->first = tmp->next;
-		free(tmp);
+	struct alloc_phase *p = a->vec[var].curr;
+	for (; p->next && p->next->start <= pos; p = p->next);
+	return p;
+}
+
+/*
+ * Counts of -ftime-report: variables, that are in memory for some time,
+ * moves between places of a variable, copies, that are not to the same
+ * place, and those, that are and emit nothing.
+ */
+static void alloc_stats(struct alloc *a, struct cmd_list *cl)
+{
+	struct cmd_list_el *tmp;
+	struct alloc_phase *p;
+	long spilled = 0, moves = 0, copies = 0, coalesced = 0;
+	int i, pos;
+
+	for (i = 0; i < a->len; ++i) {
+		int in_mem = 0;
+		for (p = a->vec[i].curr; p; p = p->next) {
+			in_mem |= is_mem(p->stid) && p->stid <= mem;
+			moves += p->next != NULL;
+		}
+		spilled += in_mem;
+	}
+	for (tmp = cl->first, pos = 1; tmp; tmp = tmp->next, ++pos) {
+		struct command *c = &tmp->cmd;
+		if (c->type != cmd_copy || c->args[0].type != 'i' ||
+				c->ret_var.type != 'i' || c->args[0].id == c->ret_var.id)
+			continue;
+		if (phase_at(a, c->args[0].id, pos)->stid !=
+				phase_at(a, c->ret_var.id, pos)->stid)
+			++copies;
+		else
+			++coalesced;
+	}
+	__atomic_add_fetch(&ctx_cur->alloc_vars, a->len, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx_cur->alloc_spilled, spilled, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx_cur->alloc_moves, moves, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx_cur->alloc_copies, copies, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx_cur->alloc_coalesced, coalesced,
+			__ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx_cur->alloc_frame, -a->st_offset,
+			__ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx_cur->alloc_slots, a->slots, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx_cur->alloc_shared, a->shared, __ATOMIC_RELAXED);
+}
+
+/*
+ * Chaitin-Briggs graph coloring. Variables interfere, if their lifespans
+ * intersect. Arguments, that come in registers, are precolored with them
+ * for the whole lifespan. A variable is either in a register or in memory
+ * for the whole lifespan, those after the sixth argument start in their
+ * place on stack.
+ */
+struct igraph {
+	int len;
+	int *adj_pos;		/* by variable: first of its neighbours in adj */
+	int *adj;
+	int *degree;
+	int *left;			/* degree in the graph, that simplify leaves */
+	int *color;			/* register, -1 if spilled */
+	char *removed;		/* taken to stack by simplify */
+};
+
+static void igraph_build(struct igraph *g, struct lifes *l,
+		struct arena *ar);
+static void simplify(struct igraph *g, struct lifes *l, int pinned,
+		int *stack, int *low, struct arena *ar);
+static void color_select(struct igraph *g, struct lifes *l, int *stack,
+		int len);
+
+static int precolored(int id, int pinned)
+{
+	return id < 6 && pinned & 1 << id;
+}
+
+static int coalesce(struct igraph *g, struct lifes *l, struct lifes *m,
+		int *alias, int pinned, struct arena *ar);
+
+/*
+ * Coalesced variables take the place of their group, alias is its head.
+ * Argument in rdx is not precolored, if multiplication or division needs
+ * rdx, while it is alive, it leaves rdx before the first command then.
+ */
+static void graph_alloc(struct alloc *a, struct lifes *l, int argnum)
+{
+	struct igraph g;
+	struct lifes m;
+	int *stack = arena_alloc(a->ar, (l->len + 1) * sizeof(int));
+	int *low = arena_alloc(a->ar, (l->len + 1) * sizeof(int));
+	int *alias = arena_alloc(a->ar, (l->len + 1) * sizeof(int));
+	int *slot = arena_alloc(a->ar, (l->len + 1) * sizeof(int));
+	int i, c, len = 0, pinned = 0;
+
+	for (i = 0; i < argnum && i < 6; ++i) {
+		if (!(fixed_clobbers(l, l->vec + i, 1) & 1 << i))
+			pinned |= 1 << i;
+	}
+	igraph_build(&g, l, a->ar);
+	if (coalesce(&g, l, &m, alias, pinned, a->ar))
+		igraph_build(&g, &m, a->ar);
+	for (i = 0; i < m.len; ++i) {
+		g.color[i] = precolored(i, pinned) ? i : -1;
+		slot[i] = 0;
+		if (!precolored(i, pinned) && m.vec[i].start != UINT_MAX)
+			++len;
+	}
+	simplify(&g, &m, pinned, stack, low, a->ar);
+	color_select(&g, &m, stack, len);
+
+	for (i = 0; i < l->len; ++i) {
+		struct lifespan *span = l->vec + i;
+		int start = span->start;
+		if (span->start == UINT_MAX)
+			continue;
+		if ((c = g.color[alias[i]]) == -1 && (i < 6 || i >= argnum)) {
+			if (slot[alias[i]] == 0)
+				slot[alias[i]] = memval(a->st_offset -= 8);
+			c = slot[alias[i]];
+		}
+		if (i < argnum && !precolored(i, pinned)) {
+			int place = i < 6 ? i : memval(16 + 8 * (i - 6));
+			if (c == -1 || span->end == 0) {
+				alloc_ins_var_state(a, i, place, 0, span->end);
+				continue;
+			}
+			alloc_ins_var_state(a, i, place, 0, 0);
+			if (i < 6)
+				spill_add(a, 1, i, 0);
+			start = 1;
+		}
+		alloc_ins_var_state(a, i, c, start, span->end);
+	}
+}
+
+static int group_find(int *alias, int v)
+{
+	while (alias[v] != v)
+		v = alias[v] = alias[alias[v]];
+	return v;
+}
+
+struct groups {
+	int *alias;
+	int *next;			/* next member of the group or -1 */
+	int *last;			/* by head: last member */
+	int *degree;		/* by head: number of neighbour groups */
+	int *mark;
+	int stamp;
+};
+
+static int joinable(struct igraph *g, struct groups *gr, int s, int b,
+		int pinned);
+static int group_count(struct igraph *g, struct groups *gr, int head,
+		int other, int stamp, int pinned, int count);
+static void group_join(struct igraph *g, struct groups *gr, int s, int b);
+
+/*
+ * Conservative coalescing of copies, that copies_fill found: group of the
+ * copy joins the group of its source, if it is still colorable for sure.
+ * Groups are chains of copies, so a group has one lifespan, m gets them
+ * by heads, the rest of members are not alive there.
+ */
+static int coalesce(struct igraph *g, struct lifes *l, struct lifes *m,
+		int *alias, int pinned, struct arena *ar)
+{
+	struct groups gr;
+	int i, s, b, res = 0;
+
+	gr.alias = alias;
+	gr.next = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	gr.last = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	gr.degree = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	gr.mark = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	gr.stamp = 0;
+	for (i = 0; i < l->len; ++i) {
+		alias[i] = gr.last[i] = i;
+		gr.next[i] = -1;
+		gr.degree[i] = g->degree[i];
+		gr.mark[i] = 0;
+	}
+	lifes_copy(m, l, ar);
+	m->copy_of = arena_alloc(ar, (l->len + 1) * sizeof(int));
+
+	for (i = 0; i < l->len; ++i) {
+		if (l->copy_of[i] == -1)
+			continue;
+		s = group_find(alias, l->copy_of[i]);
+		b = group_find(alias, i);
+		if ((l->vec[s].start == 0 && !precolored(s, pinned)) ||
+				(precolored(s, pinned) &&
+				fixed_clobbers(l, m->vec + b, 0) & 1 << s) ||
+				!joinable(g, &gr, s, b, pinned))
+			continue;
+		group_join(g, &gr, s, b);
+		m->vec[s].start = MIN(m->vec[s].start, m->vec[b].start);
+		m->vec[s].end = MAX(m->vec[s].end, m->vec[b].end);
+		m->vec[s].uses += m->vec[b].uses;
+		m->vec[b].start = m->vec[b].end = UINT_MAX;
+		++res;
+	}
+
+	for (i = 0; i < l->len; ++i) {
+		s = l->copy_of[i] == -1 ? -1 : group_find(alias, l->copy_of[i]);
+		m->copy_of[i] = group_find(alias, i) == i && s != i ? s : -1;
+	}
+	for (i = 0; i < l->len; ++i)
+		alias[i] = group_find(alias, i);
+	return res;
+}
+
+static void group_mark(struct igraph *g, struct groups *gr, int head,
+		int stamp)
+{
+	int u, i;
+	for (u = head; u != -1; u = gr->next[u]) {
+		for (i = g->adj_pos[u]; i < g->adj_pos[u] + g->degree[u]; ++i)
+			gr->mark[group_find(gr->alias, g->adj[i])] = stamp;
+	}
+}
+
+static int significant(struct groups *gr, int v, int pinned)
+{
+	return precolored(v, pinned) || gr->degree[v] >= registers_number;
+}
+
+/* Common neighbours lose one, new ones of b add to the degree of s */
+static void group_join(struct igraph *g, struct groups *gr, int s, int b)
+{
+	int stamp = gr->stamp += 3;
+	int u, i, r;
+
+	group_mark(g, gr, s, stamp);
+
+	for (u = b; u != -1; u = gr->next[u]) {
+		for (i = g->adj_pos[u]; i < g->adj_pos[u] + g->degree[u]; ++i) {
+			r = group_find(gr->alias, g->adj[i]);
+			if (gr->mark[r] == stamp)
+				--gr->degree[r];
+			else if (gr->mark[r] != stamp + 2)
+				++gr->degree[s];
+			gr->mark[r] = stamp + 2;
+		}
+	}
+	gr->alias[b] = s;
+	gr->next[gr->last[s]] = b;
+	gr->last[s] = gr->last[b];
+}
+
+/*
+ * Briggs: the joint group has less than registers_number neighbours of
+ * significant degree. George: every neighbour of b is a neighbour of s or
+ * of insignificant degree, it is the only test for a precolored source.
+ */
+static int joinable(struct igraph *g, struct groups *gr, int s, int b,
+		int pinned)
+{
+	int stamp = gr->stamp += 3;
+	int u, i, r, count;
+
+	group_mark(g, gr, s, stamp);
+	if (gr->mark[b] == stamp)
+		return 0;
+	if (!precolored(s, pinned)) {
+		count = group_count(g, gr, s, b, stamp + 1, pinned, 0);
+		count = group_count(g, gr, b, s, stamp + 1, pinned, count);
+		if (count < registers_number)
+			return 1;
+	}
+	for (u = b; u != -1; u = gr->next[u]) {
+		for (i = g->adj_pos[u]; i < g->adj_pos[u] + g->degree[u]; ++i) {
+			r = group_find(gr->alias, g->adj[i]);
+			if (r != s && gr->mark[r] != stamp &&
+					significant(gr, r, pinned))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/* Adds significant neighbours of the group, that are not counted yet */
+static int group_count(struct igraph *g, struct groups *gr, int head,
+		int other, int stamp, int pinned, int count)
+{
+	int u, i, r;
+	for (u = head; u != -1; u = gr->next[u]) {
+		for (i = g->adj_pos[u]; i < g->adj_pos[u] + g->degree[u]; ++i) {
+			r = group_find(gr->alias, g->adj[i]);
+			if (r == head || r == other || gr->mark[r] == stamp)
+				continue;
+			gr->mark[r] = stamp;
+			count += significant(gr, r, pinned);
+		}
+	}
+	return count;
+}
+
+static void igraph_sweep(struct igraph *g, struct lifes *l,
+		struct lifes *bystart, int *active, int fill);
+
+static void igraph_build(struct igraph *g, struct lifes *l,
+		struct arena *ar)
+{
+	struct lifes bystart;
+	int *active = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	int i, edges = 0;
+
+	g->len = l->len;
+	g->adj_pos = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	g->degree = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	g->left = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	g->color = arena_alloc(ar, (l->len + 1) * sizeof(int));
+	g->removed = arena_alloc(ar, l->len + 1);
+	memset(g->degree, 0, l->len * sizeof(int));
+	memset(g->removed, 0, l->len);
+
+	lifes_copy(&bystart, l, ar);
+	heapsort(&bystart, cmp_for_bystart_smaller);
+	igraph_sweep(g, l, &bystart, active, 0);
+	for (i = 0; i < l->len; ++i) {
+		g->adj_pos[i] = edges;
+		edges += g->degree[i];
+		g->degree[i] = 0;
+	}
+	g->adj = arena_alloc(ar, (edges + 1) * sizeof(int));
+	igraph_sweep(g, l, &bystart, active, 1);
+	memcpy(g->left, g->degree, l->len * sizeof(int));
+}
+
+/* Counts degrees, or fills adjacency, if they are counted */
+static void igraph_sweep(struct igraph *g, struct lifes *l,
+		struct lifes *bystart, int *active, int fill)
+{
+	int i, j, k, len = 0;
+
+	for (i = 0; i < bystart->len; ++i) {
+		struct lifespan *v = bystart->vec + i;
+		if (v->start == UINT_MAX)
+			break;
+		for (j = k = 0; j < len; ++j) {
+			if (l->vec[active[j]].end >= v->start)
+				active[k++] = active[j];
+		}
+		len = k;
+		for (j = 0; j < len; ++j) {
+			int u = active[j];
+			if (l->copy_of[v->id] == u || l->copy_of[u] == (int)v->id)
+				continue;
+			if (fill) {
+				g->adj[g->adj_pos[u] + g->degree[u]] = v->id;
+				g->adj[g->adj_pos[v->id] + g->degree[v->id]] = u;
+			}
+			++g->degree[u];
+			++g->degree[v->id];
+		}
+		active[len++] = v->id;
+	}
+}
+
+/*
+ * Spill candidates: variables of significant degree, that simplify has
+ * not taken, in a heap of the least uses per neighbour left. Removal of a
+ * neighbour only raises the cost, a variable, that gets insignificant,
+ * leaves the heap.
+ */
+struct spill_heap {
+	struct igraph *g;
+	struct lifes *l;
+	int *vec;
+	int *pos;			/* by variable: index in vec */
+	int len;
+};
+
+static void node_remove(struct igraph *g, int v, int pinned, int *low,
+		int *low_len, struct spill_heap *h);
+static void sheap_add(struct spill_heap *h, int v);
+static int sheap_take(struct spill_heap *h, int v);
+
+/*
+ * Variables with less neighbours, than there are registers, are colorable
+ * whatever the rest gets, they go to stack first. If there are none, the
+ * cheapest to spill is taken: least uses per neighbour. It is still
+ * colored optimistically, its neighbours may share registers.
+ */
+static void simplify(struct igraph *g, struct lifes *l, int pinned,
+		int *stack, int *low, struct arena *ar)
+{
+	struct spill_heap h = { g, l, NULL, NULL, 0 };
+	int low_len = 0, len = 0;
+	int i, v;
+
+	h.vec = arena_alloc(ar, (g->len + 1) * sizeof(int));
+	h.pos = arena_alloc(ar, (g->len + 1) * sizeof(int));
+	for (i = 0; i < g->len; ++i) {
+		if (precolored(i, pinned) || l->vec[i].start == UINT_MAX)
+			continue;
+		if (g->degree[i] < registers_number)
+			low[low_len++] = i;
+		else
+			sheap_add(&h, i);
+	}
+	for (;;) {
+		if (low_len > 0)
+			v = low[--low_len];
+		else if (h.len > 0)
+			v = sheap_take(&h, h.vec[0]);
+		else
+			break;
+		stack[len++] = v;
+		node_remove(g, v, pinned, low, &low_len, &h);
+	}
+}
+
+static void sheap_down(struct spill_heap *h, int i);
+
+static void node_remove(struct igraph *g, int v, int pinned, int *low,
+		int *low_len, struct spill_heap *h)
+{
+	int i;
+
+	g->removed[v] = 1;
+	for (i = g->adj_pos[v]; i < g->adj_pos[v] + g->degree[v]; ++i) {
+		int u = g->adj[i];
+		if (precolored(u, pinned) || g->removed[u])
+			continue;
+		if (g->left[u]-- == registers_number)
+			low[(*low_len)++] = sheap_take(h, u);
+		else if (g->left[u] >= registers_number)
+			sheap_down(h, h->pos[u]);
+	}
+}
+
+/* uses[a] / left[a] < uses[b] / left[b], the first variable of equal */
+static int sheap_less(struct spill_heap *h, int a, int b)
+{
+	long x = (long)h->l->vec[a].uses * h->g->left[b];
+	long y = (long)h->l->vec[b].uses * h->g->left[a];
+	return x < y || (x == y && a < b);
+}
+
+static void sheap_set(struct spill_heap *h, int i, int v)
+{
+	h->vec[i] = v;
+	h->pos[v] = i;
+}
+
+static void sheap_up(struct spill_heap *h, int i)
+{
+	int v = h->vec[i];
+	for (; i > 0 && sheap_less(h, v, h->vec[(i - 1) / 2]); i = (i - 1) / 2)
+		sheap_set(h, i, h->vec[(i - 1) / 2]);
+	sheap_set(h, i, v);
+}
+
+static void sheap_down(struct spill_heap *h, int i)
+{
+	int v = h->vec[i];
+	int c;
+	for (; (c = 2 * i + 1) < h->len; i = c) {
+		if (c + 1 < h->len && sheap_less(h, h->vec[c + 1], h->vec[c]))
+			++c;
+		if (!sheap_less(h, h->vec[c], v))
+			break;
+		sheap_set(h, i, h->vec[c]);
+	}
+	sheap_set(h, i, v);
+}
+
+static void sheap_add(struct spill_heap *h, int v)
+{
+	sheap_set(h, h->len++, v);
+	sheap_up(h, h->len - 1);
+}
+
+/* Returns v, that is no longer in the heap */
+static int sheap_take(struct spill_heap *h, int v)
+{
+	int i = h->pos[v];
+	int w = h->vec[--h->len];
+	if (w != v) {
+		sheap_set(h, i, w);
+		sheap_down(h, i);
+		sheap_up(h, h->pos[w]);
+	}
+	return v;
+}
+
+/*
+ * Stack is colored in reverse, every variable gets a register, that its
+ * colored neighbours do not have, or memory. Registers of fixed_clobbers
+ * are not given, the hint is preferred.
+ */
+static void color_select(struct igraph *g, struct lifes *l, int *stack,
+		int len)
+{
+	int i, v, used, r, c, h;
+
+	while (len > 0) {
+		v = stack[--len];
+		used = 0;
+		for (i = g->adj_pos[v]; i < g->adj_pos[v] + g->degree[v]; ++i) {
+			int u = g->adj[i];
+			if (!g->removed[u] && g->color[u] >= 0)
+				used |= 1 << g->color[u];
+		}
+		used |= fixed_clobbers(l, l->vec + v, 0);
+		g->removed[v] = 0;
+		g->color[v] = -1;
+		for (r = 0; r < registers_number && used & 1 << r; ++r);
+		if (r == registers_number)
+			continue;
+		if ((h = l->hint[v]) != -1 && !(used & 1 << h))
+			r = h;
+		else if (ctx_cur->callee_saved && lives_across(l, l->vec + v)) {
+			for (c = r; c < registers_number; ++c) {
+				if (!(used & 1 << c) && is_callee_saved(c))
+					break;
+			}
+			if (c < registers_number)
+				r = c;
+		}
+		g->color[v] = r;
 	}
 }
 
@@ -541,9 +1575,9 @@ static void print_alloc_phases(char *var, struct alloc_phase *vp);
 static void debug_allocation(struct alloc *a, struct var_sym_tbl *tb)
 {
 	int i;
-	if (dbg_allocation == 0)
+	if (DBG(allocation) == 0)
 		return;
-	eprintf("\n--Allocation--\n");
+	dbg_printf("\n--Allocation--\n");
 	for (i = 0; i < a->len; ++i) {
 		if (a->vec[i].curr == NULL)
 			continue;
@@ -551,11 +1585,20 @@ static void debug_allocation(struct alloc *a, struct var_sym_tbl *tb)
 	}
 }
 
+/* Frame is the one of variables, slots are those before sharing */
+static void debug_frame(struct alloc *a, char *name)
+{
+	if (DBG(frame) == 0)
+		return;
+	dbg_printf("frame of %s: %d bytes, %d slots, %d shared\n", name,
+			-a->st_offset, a->slots, a->shared);
+}
+
 static void print_alloc_phases(char *var, struct alloc_phase *vp)
 {
-	eprintf("\t %s| ", var);
+	dbg_printf("\t %s| ", var);
 	for (; vp; vp = vp->next) {
-		eprintf("%s: (%d-%d)", OPS(vp->stid, rbp), vp->start, vp->end);
-		eprintf(vp->next ? " -> " : "\n");
+		dbg_printf("%s: (%d-%d)", OPS(vp->stid, rbp), vp->start, vp->end);
+		dbg_printf(vp->next ? " -> " : "\n");
 	}
 }
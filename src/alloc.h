@@ -11,21 +11,28 @@ enum {
 
 	rbx,
 	r10,
-	r11,
+	rax,
 	r12,
 	r13,
 	r14,
 	r15,
 
-	rax, /* Temporary register */
+	r11, /* Temporary register */
 	rsp,
 	rbp,
 
-	registers_number = rax - 1,
+	registers_number = r11 - 1,
 	mem = (1 << 30),
 	op_sbuf_len = 20
 };
 
+/* Register allocators, -regalloc= */
+enum {
+	regalloc_linear,
+	regalloc_graph,
+	regalloc_number
+};
+
 static inline int is_reg(int val)
 {
 	return val < 1000;
@@ -36,6 +43,12 @@ static inline int is_mem(int val)
 	return val >= 1000;
 }
 
+/* Registers, that function must preserve for its caller */
+static inline int is_callee_saved(int reg)
+{
+	return reg == rbx || (reg >= r12 && reg <= r15);
+}
+
 struct alloc_phase {
 	int start;
 	int end;
@@ -48,16 +61,32 @@ struct var_state {
 	struct alloc_phase *last;
 };
 
+/* Variable leaves its register for memory before the command at pos */
+struct alloc_spill {
+	int pos;
+	int var;
+	int clean; /* slot has the value already */
+	struct alloc_spill *next;
+};
+
+struct arena;
+
 struct alloc {
 	struct var_state *vec;
 	int st_offset;
+	int saved; /* mask of callee-saved registers, that are assigned */
+	int *across; /* by call: caller-saved registers to save around it */
+	int call_next; /* calls are emitted in order, this one is next */
+	struct alloc_spill *spills; /* in order of positions, not emitted yet */
+	int slots; /* stack slots of variables before slots_share */
+	int shared; /* slots, that slots_share saved */
 	int len;
+	struct arena *ar;
 };
 
 struct function;
 
 struct alloc *allocate(struct function *f);
-void alloc_free(struct alloc *a);
 
 #define OPS(op, br) ({ char *buf = alloca(op_sbuf_len); op_string((op), buf, (br)); })
 char *op_string(int op, char *buf, int basereg);
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "arena.h"
+
+/* Blocks are double size of the previous one, up to arena_max_block */
+struct arena_block {
+	struct arena_block *next;
+	int size;
+	int used;
+	char data[] __attribute__((aligned(arena_align)));
+};
+
+void arena_init(struct arena *a)
+{
+	a->first = NULL;
+	a->used = a->peak = 0;
+}
+
+static struct arena_block *block_new(struct arena *a, int size)
+{
+	struct arena_block *tmp;
+	int bsize = arena_min_block;
+
+	if (a->first && a->first->size < arena_max_block)
+		bsize = a->first->size * 2;
+	else if (a->first)
+		bsize = arena_max_block;
+	if (size > bsize)
+		bsize = size;
+	tmp = smalloc(sizeof(struct arena_block) + bsize);
+	tmp->size = bsize;
+	tmp->used = 0;
+	tmp->next = a->first;
+	return tmp;
+}
+
+void *arena_alloc(struct arena *a, int size)
+{
+	struct arena_block *b = a->first;
+	void *res;
+
+	size = (size + arena_align - 1) & ~(arena_align - 1);
+	if (b == NULL || b->size - b->used < size)
+		a->first = b = block_new(a, size);
+	res = b->data + b->used;
+	b->used += size;
+
+	a->used += size;
+	if (a->used > a->peak) {
+		long *ctx_peak = &ctx_cur->arena_peak;
+		long cur = __atomic_load_n(ctx_peak, __ATOMIC_RELAXED);
+		a->peak = a->used;
+		/* Arenas of different workers race for the maximum */
+		while (a->peak > cur && !__atomic_compare_exchange_n(
+				ctx_peak, &cur, a->peak, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+	return res;
+}
+
+char *arena_strndup(struct arena *a, char *s, int len)
+{
+	char *tmp = arena_alloc(a, len + 1);
+	memcpy(tmp, s, len);
+	tmp[len] = 0;
+	return tmp;
+}
+
+/* Keeps only the last (largest) block for reuse */
+void arena_reset(struct arena *a)
+{
+	while (a->first && a->first->next) {
+		struct arena_block *tmp = a->first->next;
+		a->first->next = tmp->next;
+		free(tmp);
+	}
+	if (a->first)
+		a->first->used = 0;
+	a->used = 0;
+}
+
+void arena_free(struct arena *a)
+{
+	while (a->first) {
+		struct arena_block *tmp = a->first;
+		a->first = tmp->next;
+		free(tmp);
+	}
+	a->used = 0;
+}
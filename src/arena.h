@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+enum {
+	arena_min_block = 1 << 12,
+	arena_max_block = 1 << 20,
+	arena_align = 16
+};
+
+struct arena_block;
+
+struct arena {
+	struct arena_block *first;
+	long used;	/* bytes handed out since the last reset */
+	long peak;	/* max used ever */
+};
+
+void arena_init(struct arena *a);
+void *arena_alloc(struct arena *a, int size);
+char *arena_strndup(struct arena *a, char *s, int len);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+
+#endif
@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "cmdargs.h"
+#include "process.h"
+#include "batch.h"
+
+static const char *msg_failed = "files failed";
+
+/*
+ * Files of the worker are order[lo..hi). The owner takes them from the
+ * front, other workers steal from the back.
+ */
+struct range {
+	pthread_mutex_t lock;
+	int lo;
+	int hi;
+};
+
+struct batch {
+	struct ctx *ctx;
+	struct settings *sts;
+	int *order;
+	struct range *rg;
+	int workers;
+	int failed;
+};
+
+struct bworker {
+	struct batch *b;
+	int id;
+	pthread_t thread;
+};
+
+static void batch_distribute(struct batch *b);
+static void *bworker_run(void *arg);
+
+/*
+ * Every file is compiled on a single thread, as jobs of the context say,
+ * files go in parallel on jobs of settings. All of them share the context.
+ */
+int batch(struct ctx *c, struct settings *sts)
+{
+	struct batch b;
+	struct bworker *w;
+	int i, err;
+
+	b.ctx = c;
+	b.sts = sts;
+	b.workers = sts->jobs < sts->files_len ? sts->jobs : sts->files_len;
+	b.failed = 0;
+	batch_distribute(&b);
+
+	w = smalloc(b.workers * sizeof(struct bworker));
+	for (i = 0; i < b.workers; ++i) {
+		w[i].b = &b;
+		w[i].id = i;
+	}
+	for (i = 1; i < b.workers; ++i) {
+		err = pthread_create(&w[i].thread, NULL, bworker_run, w + i);
+		if (err)
+			die("%s\n", strerror(err));
+	}
+	bworker_run(w);
+	for (i = 1; i < b.workers; ++i)
+		pthread_join(w[i].thread, NULL);
+
+	for (i = 0; i < b.workers; ++i)
+		pthread_mutex_destroy(&b.rg[i].lock);
+	free(b.rg);
+	free(b.order);
+	free(w);
+	if (b.failed) {
+		eprintf("%d of %d %s\n", b.failed, sts->files_len, msg_failed);
+		return 1;
+	}
+	return 0;
+}
+
+struct file_size {
+	int id;
+	long size;
+};
+
+static int cmp_by_size(const void *a, const void *b)
+{
+	long d = ((struct file_size *)b)->size - ((struct file_size *)a)->size;
+	return d > 0 ? 1 : d < 0 ? -1 : 0;
+}
+
+/*
+ * Largest files go first and are dealt to the workers in turn, so the
+ * ranges start about equal and stealing only evens out the tail.
+ */
+static void batch_distribute(struct batch *b)
+{
+	int n = b->sts->files_len;
+	struct file_size *fs = smalloc(n * sizeof(struct file_size));
+	struct stat st;
+	int i, k, pos = 0;
+
+	for (i = 0; i < n; ++i) {
+		fs[i].id = i;
+		fs[i].size = stat(b->sts->input_files[i], &st) == 0 ? st.st_size : 0;
+	}
+	qsort(fs, n, sizeof(struct file_size), cmp_by_size);
+
+	b->order = smalloc(n * sizeof(int));
+	b->rg = smalloc(b->workers * sizeof(struct range));
+	for (k = 0; k < b->workers; ++k) {
+		pthread_mutex_init(&b->rg[k].lock, NULL);
+		b->rg[k].lo = pos;
+		for (i = k; i < n; i += b->workers)
+			b->order[pos++] = fs[i].id;
+		b->rg[k].hi = pos;
+	}
+	free(fs);
+}
+
+static int range_take(struct range *r, int *order)
+{
+	int res = -1;
+	pthread_mutex_lock(&r->lock);
+	if (r->lo < r->hi)
+		res = order[r->lo++];
+	pthread_mutex_unlock(&r->lock);
+	return res;
+}
+
+/* Moves back half of the first nonempty range of other worker to own */
+static int range_steal(struct batch *b, int id)
+{
+	struct range *own = b->rg + id;
+	int i;
+	for (i = 1; i < b->workers; ++i) {
+		struct range *r = b->rg + (id + i) % b->workers;
+		int n, hi;
+
+		pthread_mutex_lock(&r->lock);
+		n = (r->hi - r->lo + 1) / 2;
+		hi = r->hi;
+		r->hi -= n;
+		pthread_mutex_unlock(&r->lock);
+		if (n == 0)
+			continue;
+
+		pthread_mutex_lock(&own->lock);
+		own->lo = hi - n;
+		own->hi = hi;
+		pthread_mutex_unlock(&own->lock);
+		return 1;
+	}
+	return 0;
+}
+
+static void *bworker_run(void *arg)
+{
+	struct bworker *w = arg;
+	struct batch *b = w->b;
+	struct range *own = b->rg + w->id;
+	int f;
+
+	for (;;) {
+		f = range_take(own, b->order);
+		if (f == -1 && range_steal(b, w->id))
+			continue;
+		if (f == -1)
+			break;
+		if (process(b->ctx, b->sts->input_files[f],
+					b->sts->output_files[f]))
+			__atomic_add_fetch(&b->failed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
@@ -0,0 +1,9 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "ctx.h"
+#include "cmdargs.h"
+
+int batch(struct ctx *c, struct settings *sts);
+
+#endif
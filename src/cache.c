@@ -0,0 +1,412 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "func.h"
+#include "emit.h"
+#include "process.h"
+#include "cache.h"
+
+/* Version of the entry format is the last digits */
+static const char entry_magic[8] = "ilcfc09";
+static const char *entry_sfx = ".fc";
+static const char *tmp_name = "tmp.XXXXXX";
+
+enum {
+	cache_path_max = 512
+};
+
+static void put(struct obuf *b, const void *p, long len)
+{
+	obuf_put(b, p, len);
+}
+
+/* Number of global name gid in order of appearance in the function */
+static int gid_local(struct cache_key *k, int gid)
+{
+	int i;
+	for (i = 0; i < k->gids_len && k->gids[i] != gid; ++i);
+	if (i < k->gids_len)
+		return i;
+	if (k->gids_len == k->gids_cap) {
+		k->gids_cap = k->gids_cap ? k->gids_cap * 2 : 16;
+		k->gids = realloc(k->gids, k->gids_cap * sizeof(int));
+		if (k->gids == NULL)
+			die("%s\n", strerror(ENOMEM));
+	}
+	k->gids[k->gids_len] = gid;
+	return k->gids_len++;
+}
+
+/* FNV-1a, collisions are caught by comparison of the whole key */
+static unsigned long long key_hash(char *s, long len)
+{
+	unsigned long long h = 14695981039346656037ull;
+	long i;
+	for (i = 0; i < len; ++i) {
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+/* Lexems of l are not taken, l is to be parsed after that */
+void cache_key_form(struct cache_key *k, struct lexem_list *l,
+		struct gn_sym_tbl *tb, int gl_spec, int bin)
+{
+	struct lexem_block *b = ll_begin(l);
+	struct lexem_block *end = ll_end(l);
+	int head[5] = { gl_spec, bin, !bin && DBG(emit_borders),
+			ctx_cur->callee_saved, ctx_cur->regalloc };
+
+	obuf_init(&k->key);
+	k->gids = NULL;
+	k->gids_len = k->gids_cap = 0;
+	k->row = b != end ? b->crd.row : 0;
+	put(&k->key, head, sizeof(head));
+	for (; b != end; ++b) {
+		int lx[3] = { b->lt, b->crd.row - k->row, b->crd.col };
+		char *name;
+		put(&k->key, lx, sizeof(lx));
+		switch (b->lt) {
+		case lx_number:
+			put(&k->key, &b->dt.value, sizeof(long long));
+			break;
+		case lx_var_remapped:
+			put(&k->key, &b->dt.number, sizeof(int));
+			break;
+		case lx_gn_rmp:
+			gid_local(k, b->dt.number);
+			name = tb->vec[b->dt.number].name;
+			put(&k->key, name, strlen(name) + 1);
+			break;
+		default:
+			break;
+		}
+	}
+	k->hash = key_hash(k->key.buf, k->key.len);
+}
+
+void cache_key_free(struct cache_key *k)
+{
+	obuf_free(&k->key);
+	free(k->gids);
+	k->gids = NULL;
+	k->gids_len = k->gids_cap = 0;
+}
+
+static void entry_path(char *buf, char *dir, unsigned long long hash)
+{
+	snprintf(buf, cache_path_max, "%s/%016llx%s", dir, hash, entry_sfx);
+}
+
+/* Cache is never an error, so -1 just means there is no entry */
+static int file_read(char *path, struct obuf *b)
+{
+	struct stat st;
+	ssize_t got;
+	int fd = open(path, O_RDONLY);
+
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	obuf_reserve(b, st.st_size);
+	while (b->len < st.st_size) {
+		got = read(fd, b->buf + b->len, st.st_size - b->len);
+		if (got == -1 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			break;
+		b->len += got;
+	}
+	close(fd);
+	return b->len == st.st_size ? 0 : -1;
+}
+
+static int write_all(int fd, char *buf, long len)
+{
+	ssize_t got;
+	while (len > 0) {
+		got = write(fd, buf, len);
+		if (got == -1 && errno == EINTR)
+			continue;
+		if (got == -1)
+			return -1;
+		buf += got;
+		len -= got;
+	}
+	return 0;
+}
+
+/* Entry is read as a whole, bad flags truncated or alien one */
+struct reader {
+	char *p;
+	char *end;
+	int bad;
+};
+
+static void rd(struct reader *r, void *to, long len)
+{
+	if (r->bad || len < 0 || r->end - r->p < len) {
+		r->bad = 1;
+		memset(to, 0, len > 0 ? len : 0);
+		return;
+	}
+	memcpy(to, r->p, len);
+	r->p += len;
+}
+
+static void rd_fcalls(struct reader *r, struct cache_key *k,
+		struct fcall_list *fcl);
+static void rd_relocs(struct reader *r, struct cache_key *k,
+		struct emitter *em);
+
+/*
+ * Entry is magic, key, calls (gid, row, column, pattern), relocations
+ * (offset, gid) and code. Gids are local, see cache_key. Returns 1 and
+ * fills emitter and call list of j, if there is the entry.
+ */
+int cache_load(char *dir, struct cache_key *k, struct job *j, int bin)
+{
+	char path[cache_path_max];
+	char magic[sizeof(entry_magic)];
+	struct fcall_list fcl = { NULL, NULL };
+	struct emitter em;
+	struct obuf in;
+	struct reader r;
+	long len;
+	int i;
+
+	entry_path(path, dir, k->hash);
+	obuf_init(&in);
+	if (file_read(path, &in) == -1) {
+		obuf_free(&in);
+		return 0;
+	}
+	r.p = in.buf;
+	r.end = in.buf + in.len;
+	r.bad = 0;
+	rd(&r, magic, sizeof(magic));
+	rd(&r, &len, sizeof(long));
+	if (r.bad || memcmp(magic, entry_magic, sizeof(magic)) ||
+			len != k->key.len || r.end - r.p < len ||
+			memcmp(r.p, k->key.buf, len)) {
+		obuf_free(&in);
+		return 0;
+	}
+	r.p += len;
+
+	emitter_init(&em, bin);
+	rd_fcalls(&r, k, &fcl);
+	rd_relocs(&r, k, &em);
+	rd(&r, &len, sizeof(long));
+	if (len < 0 || r.end - r.p != len)
+		r.bad = 1;
+	for (i = 0; i < em.rel_len && !r.bad; ++i) {
+		if (em.rel[i].off < 0 || em.rel[i].off + 4 > len)
+			r.bad = 1;
+	}
+	if (r.bad) {
+		fcall_list_free(&fcl);
+		emitter_free(&em);
+		obuf_free(&in);
+		return 0;
+	}
+	obuf_put(&em.out, r.p, len);
+	obuf_free(&in);
+
+	j->em = em;
+	j->fcl = fcl;
+	/* Modification time is the time of last use */
+	utimensat(AT_FDCWD, path, NULL, 0);
+	return 1;
+}
+
+static void rd_fcalls(struct reader *r, struct cache_key *k,
+		struct fcall_list *fcl)
+{
+	char pat[func_max_args + 3];
+	struct coord pos;
+	int n, i, gid, len;
+
+	rd(r, &n, sizeof(int));
+	for (i = 0; i < n && !r->bad; ++i) {
+		rd(r, &gid, sizeof(int));
+		rd(r, &pos.row, sizeof(int));
+		rd(r, &pos.col, sizeof(int));
+		rd(r, &len, sizeof(int));
+		if (gid < 0 || gid >= k->gids_len || len < 0 || len >= sizeof(pat))
+			r->bad = 1;
+		rd(r, pat, len);
+		if (r->bad)
+			break;
+		pat[len] = 0;
+		pos.row += k->row;
+		fcall_list_add(fcl, k->gids[gid], pat, &pos);
+	}
+}
+
+static void rd_relocs(struct reader *r, struct cache_key *k,
+		struct emitter *em)
+{
+	long off;
+	int n, i, gid;
+
+	rd(r, &n, sizeof(int));
+	for (i = 0; i < n && !r->bad; ++i) {
+		rd(r, &off, sizeof(long));
+		rd(r, &gid, sizeof(int));
+		if (gid < 0 || gid >= k->gids_len)
+			r->bad = 1;
+		if (r->bad)
+			break;
+		emitter_add_reloc(em, off, k->gids[gid]);
+	}
+}
+
+/* Entry is written aside and renamed, so readers never see a part */
+void cache_store(char *dir, struct cache_key *k, struct job *j)
+{
+	char path[cache_path_max];
+	char tmp[cache_path_max];
+	struct fcall_list_el *f;
+	struct obuf out;
+	int n, i, fd;
+
+	obuf_init(&out);
+	put(&out, entry_magic, sizeof(entry_magic));
+	put(&out, &k->key.len, sizeof(long));
+	put(&out, k->key.buf, k->key.len);
+
+	for (n = 0, f = j->fcl.first; f; f = f->next, ++n);
+	put(&out, &n, sizeof(int));
+	for (f = j->fcl.first; f; f = f->next) {
+		int ent[4] = { gid_local(k, f->fid), f->pos.row - k->row,
+				f->pos.col, strlen(f->pattern) };
+		put(&out, ent, sizeof(ent));
+		put(&out, f->pattern, ent[3]);
+	}
+
+	put(&out, &j->em.rel_len, sizeof(int));
+	for (i = 0; i < j->em.rel_len; ++i) {
+		int gid = gid_local(k, j->em.rel[i].gid);
+		put(&out, &j->em.rel[i].off, sizeof(long));
+		put(&out, &gid, sizeof(int));
+	}
+	put(&out, &j->em.out.len, sizeof(long));
+	put(&out, j->em.out.buf, j->em.out.len);
+
+	entry_path(path, dir, k->hash);
+	snprintf(tmp, sizeof(tmp), "%s/%s", dir, tmp_name);
+	fd = mkstemp(tmp);
+	if (fd != -1) {
+		if ((write_all(fd, out.buf, out.len) | close(fd)) ||
+				rename(tmp, path) == -1)
+			unlink(tmp);
+	}
+	obuf_free(&out);
+}
+
+struct entry_info {
+	char *name;
+	long size;
+	struct timespec used;
+};
+
+static int cmp_by_use(const void *a, const void *b)
+{
+	const struct timespec *x = &((struct entry_info *)a)->used;
+	const struct timespec *y = &((struct entry_info *)b)->used;
+	if (x->tv_sec != y->tv_sec)
+		return x->tv_sec < y->tv_sec ? -1 : 1;
+	if (x->tv_nsec != y->tv_nsec)
+		return x->tv_nsec < y->tv_nsec ? -1 : 1;
+	return 0;
+}
+
+static int is_entry(char *name)
+{
+	int len = strlen(name);
+	int slen = strlen(entry_sfx);
+	return len > slen && strcmp(name + len - slen, entry_sfx) == 0;
+}
+
+static int dir_trim(char *dir, long size);
+static void debug_cache_trim(int len, long total, int removed);
+
+/*
+ * Least recently used entries are removed, until the rest fits in
+ * cache_size of c. Returns number of removed entries, c is current
+ * while they are removed.
+ */
+int cache_trim(struct ctx *c)
+{
+	struct ctx *prev = ctx_cur;
+	int removed;
+
+	ctx_cur = c;
+	removed = dir_trim(c->cache_dir, c->cache_size);
+	c->cache_evicted += removed;
+	ctx_cur = prev;
+	return removed;
+}
+
+static int dir_trim(char *dir, long size)
+{
+	struct entry_info *vec = NULL;
+	int len = 0, cap = 0, removed = 0, i;
+	long total = 0;
+	struct dirent *de;
+	struct stat st;
+	DIR *d = opendir(dir);
+
+	if (d == NULL)
+		return 0;
+	while ((de = readdir(d)) != NULL) {
+		if (!is_entry(de->d_name) ||
+				fstatat(dirfd(d), de->d_name, &st, 0) == -1)
+			continue;
+		if (len == cap) {
+			cap = cap ? cap * 2 : 256;
+			vec = realloc(vec, cap * sizeof(struct entry_info));
+			if (vec == NULL)
+				die("%s\n", strerror(ENOMEM));
+		}
+		vec[len].name = sstrdup(de->d_name);
+		vec[len].size = st.st_size;
+		vec[len].used = st.st_mtim;
+		total += st.st_size;
+		++len;
+	}
+	if (total > size)
+		qsort(vec, len, sizeof(struct entry_info), cmp_by_use);
+	for (i = 0; i < len && total > size; ++i) {
+		if (unlinkat(dirfd(d), vec[i].name, 0) == 0) {
+			total -= vec[i].size;
+			++removed;
+		}
+	}
+	closedir(d);
+	for (i = 0; i < len; ++i)
+		free(vec[i].name);
+	free(vec);
+	debug_cache_trim(len - removed, total, removed);
+	return removed;
+}
+
+static void debug_cache_trim(int len, long total, int removed)
+{
+	if (DBG(cache) == 0)
+		return;
+	dbg_printf("\n----Cache size----\n%d entries, %ld bytes, %d evicted\n",
+			len, total, removed);
+}
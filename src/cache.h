@@ -0,0 +1,37 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "obuf.h"
+#include "lparse.h"
+#include "remap.h"
+
+struct job;
+struct ctx;
+
+enum {
+	cache_default_size = 256	/* Mb */
+};
+
+/*
+ * Everything emitted code of a function depends on: its lexems with
+ * coordinates relative to the first one and names instead of global
+ * numbers. Global names are numbered in order of appearance (gids), so
+ * the entry does not depend on the rest of the module.
+ */
+struct cache_key {
+	struct obuf key;
+	unsigned long long hash;
+	int row;				/* of the first lexem */
+	int *gids;
+	int gids_len;
+	int gids_cap;
+};
+
+void cache_key_form(struct cache_key *k, struct lexem_list *l,
+		struct gn_sym_tbl *tb, int gl_spec, int bin);
+void cache_key_free(struct cache_key *k);
+int cache_load(char *dir, struct cache_key *k, struct job *j, int bin);
+void cache_store(char *dir, struct cache_key *k, struct job *j);
+int cache_trim(struct ctx *c);
+
+#endif
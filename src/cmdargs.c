@@ -1,93 +1,381 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "global.h"
+#include "input.h"
+#include "cache.h"
+#include "alloc.h"
 #include "cmdargs.h"
 
 const char *msg_help =
-"Usage: %s [-o <resfile> ] <file>\n"
+"Usage: %s [-o <resfile> | -o <dir>] [-j <jobs>] [-f <format>]\n"
+"          [--cache <dir> [--cache-size <Mb>]] [--stream] [-fcallee-saved]\n"
+"          [-regalloc=<allocator>]\n"
+"          [-ftime-report] [--trace=<file>] [-d <flag>,...] <file>...\n"
 "    Run program without any arguments or with only '--help' argument, to\n"
 "    get brief help.\n\n"
-"    -o <resfile>      Specify name of the output file.\n";
+"    -o <resfile>      Specify name of the output file.\n"
+"    -o <dir>          Put output files to directory <dir>. Used when\n"
+"                      several files are given or <dir> is directory.\n"
+"    -j <jobs>         Compile on <jobs> threads: files, if several are\n"
+"                      given, or functions of the only file.\n"
+"    -f <format>       Output format: 'nasm' (default), assembly text for\n"
+"                      nasm, or 'elf64', relocatable object file.\n"
+"    --cache <dir>     Reuse code of functions, that did not change since\n"
+"                      previous run, from <dir>. It is created if needed.\n"
+"    --cache-size <Mb> Remove least recently used code from the cache,\n"
+"                      when it gets bigger (default 256).\n"
+"    --stream          Write every function as soon as it is compiled, so\n"
+"                      memory is bounded by the largest function, not by\n"
+"                      the file. Functions of a file are compiled on one\n"
+"                      thread.\n"
+"    -fcallee-saved    Give callee-saved registers to variables, that live\n"
+"                      across calls, so calls need not save them.\n"
+"    -regalloc=<allocator>\n"
+"                      Register allocator: 'linear' (default), interval\n"
+"                      scan, or 'graph', graph coloring.\n"
+"    -ftime-report     Print time of compilation phases and number of\n"
+"                      allocations at exit.\n"
+"    --trace=<file>    Write time of every phase of every function to\n"
+"                      <file> in Chrome trace event format.\n"
+"    -d <flag>,...     Print debug output of compilation phases: all,\n"
+"                      acts_start, settings, global_lexem_parse,\n"
+"                      gn_borders, function_header, vars_remapped,\n"
+"                      commands, lifespan, heapsort, allocation, frame,\n"
+"                      fcall_list, gn_pre, gn_post, arena, emit_speed,\n"
+"                      cache. emit_borders marks functions in the output.\n"
+"    @<file>           Read arguments from <file>, separated by white\n"
+"                      space.\n";
 const char *flag_help = "--help";
 const char *flag_ofile = "-o";
+const char *flag_jobs = "-j";
+const char *flag_format = "-f";
+const char *flag_cache = "--cache";
+const char *flag_cache_size = "--cache-size";
+const char *flag_stream = "--stream";
+const char *flag_callee_saved = "-fcallee-saved";
+const char *flag_regalloc = "-regalloc=";
+const char *flag_time_report = "-ftime-report";
+const char *flag_trace = "--trace=";
+const char *flag_debug = "-d";
 const char *msg_no_ofile = "missing output file";
+const char *msg_no_jobs = "missing number of jobs";
+const char *msg_bad_jobs = "number of jobs must be in range 1-256";
+const char *msg_no_format = "missing output format";
+const char *msg_bad_format = "unknown output format";
+const char *msg_no_cache = "missing cache directory";
+const char *msg_bad_cache_size = "cache size must be positive number of Mb";
+const char *msg_no_trace = "missing trace file";
+const char *msg_bad_regalloc = "unknown register allocator";
+const char *msg_no_debug = "missing debug flags";
+const char *msg_bad_debug = "unknown debug flag";
 const char *msg_no_ifile = "no input file specified";
-const char *msg_dup_ifile = "input file already given";
 const char *msg_empty_ifile = "input file name is empty string";
 const char *msg_empty_ofile = "outputfile name is empty string";
 const char *msg_ifile_name_too_long = "input file name is too long";
 const char *msg_ofile_name_too_long = "output file name is too long";
+const char *msg_not_dir = "not a directory";
+const char *msg_rsp_nested = "response files nested too deep";
+const char *msg_same_ofile = "have the same output file";
 
 const char *ifile_sfx = ".il";
-const char *ofile_sfx = ".s";
+const char *format_names[] = {
+	[fmt_nasm] = "nasm",
+	[fmt_elf64] = "elf64"
+};
+const char *regalloc_names[] = {
+	[regalloc_linear] = "linear",
+	[regalloc_graph] = "graph"
+};
+const char *ofile_sfx[] = {
+	[fmt_nasm] = ".s",
+	[fmt_elf64] = ".o"
+};
 
+struct arglist {
+	char **vec;
+	int len;
+	int cap;
+};
+
+static void args_expand(struct arglist *al, struct arglist *rsp, char *arg,
+		int depth);
+static int format_get(char *s);
+static int regalloc_get(char *s);
 static void settings_check(struct settings *s);
 static void settings_complete(struct settings *sts);
 static void debug_settings_print(struct settings *sts);
 
 void cmdargs_handle(int argc, char **argv, struct settings *s)
 {
+	struct arglist al = { NULL, 0, 0 };
+	struct arglist rsp = { NULL, 0, 0 };
+	int i;
+
 	s->output_file = NULL;
+	s->jobs = 1;
+	s->format = fmt_nasm;
+	s->cache_dir = NULL;
+	s->cache_size = cache_default_size;
+	s->stream = 0;
+	s->callee_saved = 0;
+	s->regalloc = regalloc_linear;
+	s->time_report = 0;
+	s->trace_file = NULL;
+	s->dbg = ctx_cur->dbg;
 
 	if (argc == 1 || (argc == 2 && strcmp(argv[1], flag_help) == 0)) {
 		printf(msg_help, argv[0]);
 		exit(0);
 	}
-	for (++argv; *argv; ++argv) {
-		if (strcmp(*argv, flag_ofile) == 0) {
-			if (argv[1] == NULL)
+	for (++argv; *argv; ++argv)
+		args_expand(&al, &rsp, *argv, 0);
+
+	s->input_files = smalloc((al.len + 1) * sizeof(char *));
+	s->files_len = 0;
+	for (i = 0; i < al.len; ++i) {
+		if (strcmp(al.vec[i], flag_ofile) == 0) {
+			if (i + 1 == al.len)
 				die("%s: %s\n", flag_ofile, msg_no_ofile);
-			++argv;
-			s->output_file = *argv;
+			s->output_file = al.vec[++i];
+		} else if (strcmp(al.vec[i], flag_jobs) == 0) {
+			if (i + 1 == al.len)
+				die("%s: %s\n", flag_jobs, msg_no_jobs);
+			s->jobs = atoi(al.vec[++i]);
+			if (s->jobs < 1 || s->jobs > max_jobs)
+				die("%s: %s\n", flag_jobs, msg_bad_jobs);
+		} else if (strcmp(al.vec[i], flag_format) == 0) {
+			if (i + 1 == al.len)
+				die("%s: %s\n", flag_format, msg_no_format);
+			s->format = format_get(al.vec[++i]);
+		} else if (strcmp(al.vec[i], flag_cache) == 0) {
+			if (i + 1 == al.len)
+				die("%s: %s\n", flag_cache, msg_no_cache);
+			s->cache_dir = al.vec[++i];
+		} else if (strcmp(al.vec[i], flag_cache_size) == 0) {
+			if (i + 1 == al.len || (s->cache_size = atol(al.vec[++i])) < 1)
+				die("%s: %s\n", flag_cache_size, msg_bad_cache_size);
+		} else if (strcmp(al.vec[i], flag_stream) == 0) {
+			s->stream = 1;
+		} else if (strcmp(al.vec[i], flag_callee_saved) == 0) {
+			s->callee_saved = 1;
+		} else if (strncmp(al.vec[i], flag_regalloc,
+					strlen(flag_regalloc)) == 0) {
+			s->regalloc = regalloc_get(al.vec[i] + strlen(flag_regalloc));
+		} else if (strcmp(al.vec[i], flag_time_report) == 0) {
+			s->time_report = 1;
+		} else if (strncmp(al.vec[i], flag_trace, strlen(flag_trace)) == 0) {
+			s->trace_file = al.vec[i] + strlen(flag_trace);
+			if (*s->trace_file == 0)
+				die("%s: %s\n", flag_trace, msg_no_trace);
+		} else if (strcmp(al.vec[i], flag_debug) == 0) {
+			if (i + 1 == al.len)
+				die("%s: %s\n", flag_debug, msg_no_debug);
+			if (dbg_flags_parse(&s->dbg, al.vec[++i]) == -1)
+				die("%s: %s\n", al.vec[i], msg_bad_debug);
 		} else {
-			break;
+			s->input_files[s->files_len++] = al.vec[i];
 		}
 	}
-	if (*argv == NULL)
+	free(al.vec);
+	if (s->files_len == 0)
 		die("%s\n", msg_no_ifile);
-	s->input_file = *argv;
-	if (argv[1] != NULL)
-		die("%s: %s\n", argv[1], msg_dup_ifile);
 	settings_check(s);
 	settings_complete(s);
+	for (i = 0; i < rsp.len; ++i)
+		free(rsp.vec[i]);
+	free(rsp.vec);
 	debug_settings_print(s);
 }
 
+static void args_add(struct arglist *al, char *arg)
+{
+	if (al->len == al->cap) {
+		al->cap = al->cap ? al->cap * 2 : 16;
+		al->vec = realloc(al->vec, al->cap * sizeof(char *));
+		if (al->vec == NULL)
+			die("%s\n", strerror(ENOMEM));
+	}
+	al->vec[al->len++] = arg;
+}
+
+static inline int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/*
+ * Arguments of response file may name other response files. Strings read
+ * from them are kept in rsp, until settings_complete copies them.
+ */
+static void args_expand(struct arglist *al, struct arglist *rsp, char *arg,
+		int depth)
+{
+	struct input in;
+	long i, start;
+
+	if (arg[0] != '@') {
+		args_add(al, arg);
+		return;
+	}
+	if (depth == max_rsp_depth)
+		die("%s: %s\n", arg, msg_rsp_nested);
+
+	input_open(&in, arg + 1);
+	for (i = 0; i < in.len; ) {
+		for (; i < in.len && is_space(in.data[i]); ++i);
+		for (start = i; i < in.len && !is_space(in.data[i]); ++i);
+		if (i > start) {
+			char *tmp = smalloc(i - start + 1);
+			memcpy(tmp, in.data + start, i - start);
+			tmp[i - start] = 0;
+			args_add(rsp, tmp);
+			args_expand(al, rsp, tmp, depth + 1);
+		}
+	}
+	input_close(&in);
+}
+
+static int format_get(char *s)
+{
+	int i;
+	for (i = 0; i < fmt_number; ++i) {
+		if (strcmp(s, format_names[i]) == 0)
+			return i;
+	}
+	die("%s: %s\n", s, msg_bad_format);
+	return -1;
+}
+
+static int regalloc_get(char *s)
+{
+	int i;
+	for (i = 0; i < regalloc_number; ++i) {
+		if (strcmp(s, regalloc_names[i]) == 0)
+			return i;
+	}
+	die("%s: %s\n", s, msg_bad_regalloc);
+	return -1;
+}
+
+static int is_dir(char *s)
+{
+	struct stat st;
+	return stat(s, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
 static void settings_check(struct settings *s)
 {
-	if (s->input_file[0] == 0)
-		die("%s\n", msg_empty_ifile);
+	int i;
+	for (i = 0; i < s->files_len; ++i) {
+		if (s->input_files[i][0] == 0)
+			die("%s\n", msg_empty_ifile);
+		if (strlen(s->input_files[i]) > 256)
+			die("%s: %s\n", s->input_files[i], msg_ifile_name_too_long);
+	}
 	if (s->output_file && s->output_file[0] == 0)
 		die("%s\n", msg_empty_ofile);
-	if (strlen(s->input_file) > 256)
-		die("%s\n", msg_ifile_name_too_long);
 	if (s->output_file && strlen(s->output_file) > 256)
 		die("%s\n", msg_ofile_name_too_long);
+	if (s->output_file && s->files_len > 1 && !is_dir(s->output_file))
+		die("%s: %s\n", s->output_file, msg_not_dir);
+	if (s->cache_dir && !is_dir(s->cache_dir) &&
+			mkdir(s->cache_dir, 0777) == -1)
+		die("%s: %s\n", s->cache_dir, strerror(errno));
 }
 
-static int ends_with(char *s1, char *s2);
+static char *str_own(char *s);
+static char *output_name(char *input, char *dir, const char *sfx);
+static void output_check(struct settings *sts);
 
+/* Settings own their strings, arguments may be freed after it */
 static void settings_complete(struct settings *sts)
 {
-	char buffer[267];
-	char *tmp;
-	int pos;
+	char *dir = NULL;
+	int i;
 
-	if (sts->output_file)
+	for (i = 0; i < sts->files_len; ++i)
+		sts->input_files[i] = str_own(sts->input_files[i]);
+	sts->output_file = str_own(sts->output_file);
+	sts->cache_dir = str_own(sts->cache_dir);
+	sts->trace_file = str_own(sts->trace_file);
+
+	sts->output_files = smalloc(sts->files_len * sizeof(char *));
+	if (sts->output_file && sts->files_len == 1 &&
+			!is_dir(sts->output_file)) {
+		sts->output_files[0] = sstrdup(sts->output_file);
 		return;
+	}
+	if (sts->output_file)
+		dir = sts->output_file;
+	for (i = 0; i < sts->files_len; ++i)
+		sts->output_files[i] = output_name(sts->input_files[i], dir,
+				ofile_sfx[sts->format]);
+	output_check(sts);
+}
+
+static char *str_own(char *s)
+{
+	return s ? sstrdup(s) : NULL;
+}
+
+static int cmp_output(const void *a, const void *b)
+{
+	return strcmp(**(char ***)a, **(char ***)b);
+}
+
+/*
+ * Files of a batch are written at the same time by different workers, so
+ * two inputs with the same name in different directories are an error.
+ */
+static void output_check(struct settings *sts)
+{
+	char ***vec = smalloc(sts->files_len * sizeof(char **));
+	int i, a, b;
+
+	for (i = 0; i < sts->files_len; ++i)
+		vec[i] = sts->output_files + i;
+	qsort(vec, sts->files_len, sizeof(char **), cmp_output);
+	for (i = 1; i < sts->files_len; ++i) {
+		if (strcmp(*vec[i - 1], *vec[i]) != 0)
+			continue;
+		a = vec[i - 1] - sts->output_files;
+		b = vec[i] - sts->output_files;
+		die("%s, %s: %s %s\n", sts->input_files[a < b ? a : b],
+				sts->input_files[a < b ? b : a], msg_same_ofile,
+				*vec[i]);
+	}
+	free(vec);
+}
+
+static int ends_with(char *s1, char *s2);
+
+/* Name of input without directory and '.il' suffix, plus sfx */
+static char *output_name(char *input, char *dir, const char *sfx)
+{
+	char *tmp, *res;
+	int pos, dlen;
 
-	tmp = strrchr(sts->input_file, '/');
+	tmp = strrchr(input, '/');
 	if (tmp == NULL)
 		pos = 0;
 	else
-		pos = tmp - sts->input_file + 1;
-	strcpy(buffer, sts->input_file + pos);
+		pos = tmp - input + 1;
+	input += pos;
 
-	pos = ends_with(buffer, ifile_sfx);
-	strcpy(buffer + pos, ofile_sfx);
-	sts->output_file = sstrdup(buffer);
+	dlen = dir ? strlen(dir) + 1 : 0;
+	res = smalloc(dlen + strlen(input) + strlen(sfx) + 1);
+	if (dir) {
+		strcpy(res, dir);
+		res[dlen - 1] = '/';
+	}
+	strcpy(res + dlen, input);
+	pos = ends_with(res + dlen, ifile_sfx);
+	strcpy(res + dlen + pos, sfx);
+	return res;
 }
 
 static int ends_with(char *s1, char *s2)
@@ -103,11 +391,39 @@ static int ends_with(char *s1, char *s2)
 	return offset;
 }
 
+void settings_free(struct settings *sts)
+{
+	int i;
+	for (i = 0; i < sts->files_len; ++i) {
+		free(sts->input_files[i]);
+		free(sts->output_files[i]);
+	}
+	free(sts->output_files);
+	free(sts->input_files);
+	free(sts->output_file);
+	free(sts->cache_dir);
+	free(sts->trace_file);
+}
+
 static void debug_settings_print(struct settings *sts)
 {
-	if (dbg_settings == 0)
+	int i;
+	if (DBG_IN(sts->dbg, settings) == 0)
 		return;
-	eprintf("------Settings------\n\n");
-	eprintf("Input file: %s\n", sts->input_file);
-	eprintf("Output file: %s\n", sts->output_file);
+	dbg_printf("------Settings------\n\n");
+	for (i = 0; i < sts->files_len; ++i) {
+		dbg_printf("Input file: %s\n", sts->input_files[i]);
+		dbg_printf("Output file: %s\n", sts->output_files[i]);
+	}
+	dbg_printf("Jobs: %d\n", sts->jobs);
+	dbg_printf("Format: %s\n", format_names[sts->format]);
+	dbg_printf("Register allocator: %s\n", regalloc_names[sts->regalloc]);
+	if (sts->cache_dir)
+		dbg_printf("Cache: %s, %ld Mb\n", sts->cache_dir, sts->cache_size);
+	if (sts->stream)
+		dbg_printf("Streaming\n");
+	if (sts->callee_saved)
+		dbg_printf("Callee-saved registers across calls\n");
+	if (sts->trace_file)
+		dbg_printf("Trace: %s\n", sts->trace_file);
 }
@@ -1,11 +1,37 @@
 #ifndef CMDARGS_H
 #define CMDARGS_H
 
+#include "ctx.h"
+
+enum {
+	max_jobs = 256,
+	max_rsp_depth = 8
+};
+
+enum {
+	fmt_nasm,
+	fmt_elf64,
+	fmt_number
+};
+
 struct settings {
-	char *input_file;
-	char *output_file;
+	char **input_files;
+	char **output_files;	/* one for every input file */
+	int files_len;
+	char *output_file;		/* as given by -o, file or directory */
+	int jobs;
+	int format;
+	char *cache_dir;
+	long cache_size;		/* Mb */
+	int stream;
+	int callee_saved;
+	int regalloc;
+	int time_report;
+	char *trace_file;
+	struct dbg_flags dbg;
 };
 
 void cmdargs_handle(int argc, char **argv, struct settings *s);
+void settings_free(struct settings *sts);
 
 #endif
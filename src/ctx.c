@@ -0,0 +1,161 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "ctx.h"
+
+static struct ctx ctx_default = {
+	.jobs = 1,
+	.cache_size = (long)cache_default_size << 20,
+	.free_all_mem = 1,
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+__thread struct ctx *ctx_cur = &ctx_default;
+
+void ctx_init(struct ctx *c)
+{
+	memset(c, 0, sizeof(struct ctx));
+	c->jobs = ctx_default.jobs;
+	c->format = ctx_default.format;
+	c->dbg = ctx_default.dbg;
+	c->free_all_mem = ctx_default.free_all_mem;
+	c->cache_size = ctx_default.cache_size;
+	pthread_mutex_init(&c->lock, NULL);
+}
+
+void ctx_free(struct ctx *c)
+{
+	int i;
+	for (i = 0; i < c->diags_len; ++i) {
+		free(c->diags[i].file);
+		free(c->diags[i].msg);
+	}
+	free(c->diags);
+	if (c->trace.buf)
+		obuf_free(&c->trace);
+	pthread_mutex_destroy(&c->lock);
+}
+
+static char *dup_or_null(char *s)
+{
+	return s ? strdup(s) : NULL;
+}
+
+static int diags_grow(struct ctx *c)
+{
+	int cap = c->diags_cap ? c->diags_cap * 2 : 16;
+	struct diag *tmp = realloc(c->diags, cap * sizeof(struct diag));
+	if (tmp == NULL)
+		return -1;
+	c->diags = tmp;
+	c->diags_cap = cap;
+	return 0;
+}
+
+/*
+ * Called while an error is being reported, so it can't die itself:
+ * diagnostic, that does not fit in memory, is lost.
+ */
+void ctx_diag_add(struct ctx *c, enum diag_kind kind, char *file,
+		char *msg)
+{
+	struct diag d;
+
+	d.kind = kind;
+	d.file = dup_or_null(file);
+	d.msg = dup_or_null(msg);
+	pthread_mutex_lock(&c->lock);
+	if (d.msg == NULL || (file && d.file == NULL) ||
+			(c->diags_len == c->diags_cap && diags_grow(c) == -1)) {
+		free(d.file);
+		free(d.msg);
+	} else {
+		c->diags[c->diags_len++] = d;
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+#define DBG_NAME(flag) { #flag, offsetof(struct dbg_flags, flag) }
+
+static const struct {
+	char *name;
+	int off;
+} dbg_flag_names[] = {
+	DBG_NAME(acts_start),
+	DBG_NAME(settings),
+	DBG_NAME(global_lexem_parse),
+	DBG_NAME(gn_borders),
+	DBG_NAME(function_header),
+	DBG_NAME(vars_remapped),
+	DBG_NAME(commands),
+	DBG_NAME(lifespan),
+	DBG_NAME(heapsort),
+	DBG_NAME(allocation),
+	DBG_NAME(frame),
+	DBG_NAME(fcall_list),
+	DBG_NAME(gn_pre),
+	DBG_NAME(gn_post),
+	DBG_NAME(emit_borders),
+	DBG_NAME(arena),
+	DBG_NAME(emit_speed),
+	DBG_NAME(cache)
+};
+
+enum {
+	dbg_flags_number = sizeof(dbg_flag_names) / sizeof(dbg_flag_names[0])
+};
+
+/*
+ * Sets flags of comma separated list, "all" sets every flag. Returns -1
+ * if a name is unknown.
+ */
+int dbg_flags_parse(struct dbg_flags *d, char *list)
+{
+	char *p = list;
+	int len, i;
+
+	while (*p) {
+		len = strcspn(p, ",");
+		if (len == 3 && strncmp(p, "all", 3) == 0) {
+			memset(d, 1, sizeof(struct dbg_flags));
+		} else {
+			for (i = 0; i < dbg_flags_number; ++i) {
+				if (strlen(dbg_flag_names[i].name) == len &&
+						strncmp(dbg_flag_names[i].name, p, len) == 0)
+					break;
+			}
+			if (i == dbg_flags_number)
+				return -1;
+			((char *)d)[dbg_flag_names[i].off] = 1;
+		}
+		p += len;
+		if (*p == ',')
+			++p;
+	}
+	return 0;
+}
+
+static FILE *dbg_default;
+static pthread_once_t dbg_once = PTHREAD_ONCE_INIT;
+
+/* Stream of its own on the same descriptor, so stderr stays unbuffered */
+static void dbg_open()
+{
+	int fd = dup(2);
+	dbg_default = fd == -1 ? NULL : fdopen(fd, "w");
+	if (dbg_default)
+		setvbuf(dbg_default, NULL, _IOFBF, 1 << 16);
+	else
+		dbg_default = stderr;
+}
+
+FILE *dbg_stream()
+{
+	if (ctx_cur->dbg_out)
+		return ctx_cur->dbg_out;
+	pthread_once(&dbg_once, dbg_open);
+	return dbg_default;
+}
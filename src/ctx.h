@@ -0,0 +1,111 @@
+#ifndef CTX_H
+#define CTX_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "obuf.h"
+#include "trace.h"
+
+/* Debug output of compilation, selected by -d, all off by default */
+struct dbg_flags {
+	char acts_start;
+	char settings;
+	char global_lexem_parse;
+	char gn_borders;
+	char function_header;
+	char vars_remapped;
+	char commands;
+	char lifespan;
+	char allocation;
+	char frame;
+	char fcall_list;
+	char gn_pre;
+	char gn_post;
+	char emit_borders;
+	char arena;
+	char emit_speed;
+	char cache;
+	char heapsort;
+};
+
+enum diag_kind {
+	diag_error,
+	diag_warning
+};
+
+struct diag {
+	enum diag_kind kind;
+	char *file;			/* NULL if not about a file */
+	char *msg;
+};
+
+/* Takes output instead of the output file, returns 0 on success */
+typedef int (*ctx_sink)(void *arg, const char *buf, long len);
+
+/*
+ * Settings and results of compilation. Contexts share nothing, so any
+ * number of them may be used on different threads at once. Threads of
+ * one context (workers, batch) append diagnostics under the lock.
+ */
+struct ctx {
+	int jobs;				/* threads compiling functions of one file */
+	int format;
+	struct dbg_flags dbg;
+	FILE *dbg_out;			/* debug output, buffered stderr if NULL */
+	int free_all_mem;		/* everything is freed, not left to exit */
+	int quiet;				/* diagnostics are only kept, not printed */
+	char *cache_dir;		/* of compiled functions, NULL if no cache */
+	long cache_size;		/* bytes, cache_trim keeps it */
+	int stream;				/* functions are written once compiled */
+	int callee_saved;		/* across calls callee-saved are preferred */
+	int regalloc;			/* allocator, enum of alloc.h */
+	ctx_sink sink;
+	void *sink_arg;
+	pthread_mutex_t lock;
+	struct diag *diags;
+	int diags_len;
+	int diags_cap;
+	long arena_peak;		/* max peak of arenas of the context */
+	int time_report;		/* phases are timed and reported at exit */
+	char *trace_file;		/* spans of phases go there, NULL if not */
+	long phase_ns[phases_number];	/* summed over threads */
+	int phase_calls[phases_number];
+	long alloc_calls;		/* through smalloc, if time_report */
+	long alloc_bytes;
+	long alloc_vars;		/* register allocation, see alloc_stats */
+	long alloc_spilled;
+	long alloc_moves;
+	long alloc_copies;
+	long alloc_coalesced;		/* copies, that emit nothing */
+	long alloc_frame;		/* bytes of variables on stack */
+	long alloc_slots;		/* stack slots before slots_share */
+	long alloc_shared;		/* slots, that slots_share saved */
+	long cache_hits;		/* of all files, if time_report */
+	long cache_misses;
+	long cache_evicted;		/* by cache_trim */
+	struct obuf trace;		/* events of trace_file, see trace_span */
+};
+
+/* Context of the running compilation, the default one outside of it */
+extern __thread struct ctx *ctx_cur;
+
+/*
+ * Debug output is rare, so the check is a branch predicted not taken.
+ * ILC_NO_DEBUG removes debug output at compile time.
+ */
+#ifdef ILC_NO_DEBUG
+#define DBG_IN(flags, flag) 0
+#else
+#define DBG_IN(flags, flag) __builtin_expect((flags).flag, 0)
+#endif
+#define DBG(flag) DBG_IN(ctx_cur->dbg, flag)
+
+void ctx_init(struct ctx *c);
+void ctx_free(struct ctx *c);
+void ctx_diag_add(struct ctx *c, enum diag_kind kind, char *file,
+		char *msg);
+int dbg_flags_parse(struct dbg_flags *d, char *list);
+FILE *dbg_stream();
+
+#endif
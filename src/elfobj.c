@@ -0,0 +1,252 @@
+#include <elf.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "obuf.h"
+#include "elfobj.h"
+
+enum {
+	sec_null,
+	sec_text,
+	sec_rela,
+	sec_symtab,
+	sec_strtab,
+	sec_shstrtab,
+	sec_note,
+	sec_number
+};
+
+static const char *sec_names[] = {
+	[sec_null] = "",
+	[sec_text] = ".text",
+	[sec_rela] = ".rela.text",
+	[sec_symtab] = ".symtab",
+	[sec_strtab] = ".strtab",
+	[sec_shstrtab] = ".shstrtab",
+	[sec_note] = ".note.GNU-stack"
+};
+
+void elf_init(struct elf_obj *o)
+{
+	memset(o, 0, sizeof(struct elf_obj));
+}
+
+/* Returns offset of the function in .text */
+long elf_add_func(struct elf_obj *o, int sym, long size)
+{
+	struct elf_func *tmp;
+	if (o->funcs_len == o->funcs_cap) {
+		o->funcs_cap = o->funcs_cap ? o->funcs_cap * 2 : 64;
+		o->funcs = realloc(o->funcs, o->funcs_cap * sizeof(struct elf_func));
+		if (o->funcs == NULL)
+			die("%s\n", strerror(ENOMEM));
+	}
+	tmp = o->funcs + o->funcs_len++;
+	tmp->sym = sym;
+	tmp->value = o->text_len;
+	tmp->size = size;
+	o->text_len += size;
+	return tmp->value;
+}
+
+/* Symbols are zeroed, value and size of functions are set by elf_build */
+void elf_syms_init(struct elf_obj *o, int syms_len)
+{
+	o->syms_len = syms_len;
+	o->syms = smalloc((syms_len + 1) * sizeof(struct elf_sym));
+	memset(o->syms, 0, syms_len * sizeof(struct elf_sym));
+}
+
+int elf_head_size()
+{
+	return sizeof(Elf64_Ehdr);
+}
+
+void elf_add_rel(struct elf_obj *o, long off, int sym)
+{
+	if (o->rels_len == o->rels_cap) {
+		o->rels_cap = o->rels_cap ? o->rels_cap * 2 : 64;
+		o->rels = realloc(o->rels, o->rels_cap * sizeof(struct elf_rel));
+		if (o->rels == NULL)
+			die("%s\n", strerror(ENOMEM));
+	}
+	o->rels[o->rels_len].off = off;
+	o->rels[o->rels_len].sym = sym;
+	++o->rels_len;
+}
+
+void elf_free(struct elf_obj *o)
+{
+	free(o->syms);
+	free(o->rels);
+	free(o->funcs);
+	elf_init(o);
+}
+
+/* Pads b, that is placed at base in the file, to 8 bytes */
+static void pad8(struct obuf *b, long base)
+{
+	static const char zero[8];
+	obuf_put(b, zero, -(base + b->len) & 7);
+}
+
+static int add_str(struct obuf *b, const char *s)
+{
+	int pos = b->len;
+	obuf_put(b, s, strlen(s) + 1);
+	return pos;
+}
+
+static void put_sym(struct obuf *b, int name, int info, int shndx,
+		long value, long size)
+{
+	Elf64_Sym s;
+	s.st_name = name;
+	s.st_info = info;
+	s.st_other = STV_DEFAULT;
+	s.st_shndx = shndx;
+	s.st_value = value;
+	s.st_size = size;
+	obuf_put(b, (char *)&s, sizeof(Elf64_Sym));
+}
+
+/*
+ * Local symbols go first, as ELF demands. Returns index of the first
+ * global one, index of every symbol is put into idx.
+ */
+static int build_symtab(struct elf_obj *o, char *source, struct obuf *sym,
+		struct obuf *str, int *idx)
+{
+	int i, pass, n, first_global = 0;
+
+	add_str(str, "");
+	put_sym(sym, 0, 0, SHN_UNDEF, 0, 0);
+	put_sym(sym, add_str(str, source), ELF64_ST_INFO(STB_LOCAL, STT_FILE),
+			SHN_ABS, 0, 0);
+	n = 2;
+	for (pass = 0; pass < 2; ++pass) {
+		if (pass == 1)
+			first_global = n;
+		for (i = 0; i < o->syms_len; ++i) {
+			struct elf_sym *s = o->syms + i;
+			int global = s->global || !s->defined;
+			if (global != pass)
+				continue;
+			put_sym(sym, add_str(str, s->name),
+					ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL,
+						s->defined ? STT_FUNC : STT_NOTYPE),
+					s->defined ? sec_text : SHN_UNDEF,
+					s->value, s->size);
+			idx[i] = n++;
+		}
+	}
+	return first_global;
+}
+
+static void put_shdr(struct obuf *b, int name, int type, int flags,
+		long off, long size, int link, int info, int align, int entsize)
+{
+	Elf64_Shdr s;
+	memset(&s, 0, sizeof(Elf64_Shdr));
+	s.sh_name = name;
+	s.sh_type = type;
+	s.sh_flags = flags;
+	s.sh_offset = off;
+	s.sh_size = size;
+	s.sh_link = link;
+	s.sh_info = info;
+	s.sh_addralign = align;
+	s.sh_entsize = entsize;
+	obuf_put(b, (char *)&s, sizeof(Elf64_Shdr));
+}
+
+void elf_build(struct elf_obj *o, char *source, struct obuf *head,
+		struct obuf *tail)
+{
+	struct obuf str, shstr;
+	int *idx = smalloc((o->syms_len + 1) * sizeof(int));
+	long base = sizeof(Elf64_Ehdr) + o->text_len;
+	long off[sec_number], size[sec_number];
+	int names[sec_number];
+	int first_global, i;
+	Elf64_Ehdr eh;
+
+	obuf_init(&str);
+	obuf_init(&shstr);
+
+	for (i = 0; i < o->funcs_len; ++i) {
+		o->syms[o->funcs[i].sym].value = o->funcs[i].value;
+		o->syms[o->funcs[i].sym].size = o->funcs[i].size;
+	}
+
+	/* Tail starts right after text, its sections are 8 aligned */
+	pad8(tail, base);
+	off[sec_symtab] = base + tail->len;
+	first_global = build_symtab(o, source, tail, &str, idx);
+	size[sec_symtab] = base + tail->len - off[sec_symtab];
+
+	off[sec_strtab] = base + tail->len;
+	obuf_put(tail, str.buf, str.len);
+	size[sec_strtab] = str.len;
+	pad8(tail, base);
+
+	off[sec_rela] = base + tail->len;
+	for (i = 0; i < o->rels_len; ++i) {
+		Elf64_Rela r;
+		r.r_offset = o->rels[i].off;
+		r.r_info = ELF64_R_INFO(idx[o->rels[i].sym], R_X86_64_PLT32);
+		r.r_addend = -4;
+		obuf_put(tail, (char *)&r, sizeof(Elf64_Rela));
+	}
+	size[sec_rela] = base + tail->len - off[sec_rela];
+
+	for (i = 0; i < sec_number; ++i)
+		names[i] = add_str(&shstr, sec_names[i]);
+	off[sec_shstrtab] = base + tail->len;
+	obuf_put(tail, shstr.buf, shstr.len);
+	size[sec_shstrtab] = shstr.len;
+	pad8(tail, base);
+
+	off[sec_text] = sizeof(Elf64_Ehdr);
+	size[sec_text] = o->text_len;
+	off[sec_note] = base + tail->len;
+	size[sec_note] = 0;
+
+	memset(&eh, 0, sizeof(Elf64_Ehdr));
+	memcpy(eh.e_ident, ELFMAG, SELFMAG);
+	eh.e_ident[EI_CLASS] = ELFCLASS64;
+	eh.e_ident[EI_DATA] = ELFDATA2LSB;
+	eh.e_ident[EI_VERSION] = EV_CURRENT;
+	eh.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+	eh.e_type = ET_REL;
+	eh.e_machine = EM_X86_64;
+	eh.e_version = EV_CURRENT;
+	eh.e_shoff = base + tail->len;
+	eh.e_ehsize = sizeof(Elf64_Ehdr);
+	eh.e_shentsize = sizeof(Elf64_Shdr);
+	eh.e_shnum = sec_number;
+	eh.e_shstrndx = sec_shstrtab;
+	obuf_put(head, (char *)&eh, sizeof(Elf64_Ehdr));
+
+	put_shdr(tail, 0, SHT_NULL, 0, 0, 0, 0, 0, 0, 0);
+	put_shdr(tail, names[sec_text], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+			off[sec_text], size[sec_text], 0, 0, 16, 0);
+	put_shdr(tail, names[sec_rela], SHT_RELA, SHF_INFO_LINK,
+			off[sec_rela], size[sec_rela], sec_symtab, sec_text, 8,
+			sizeof(Elf64_Rela));
+	put_shdr(tail, names[sec_symtab], SHT_SYMTAB, 0,
+			off[sec_symtab], size[sec_symtab], sec_strtab, first_global, 8,
+			sizeof(Elf64_Sym));
+	put_shdr(tail, names[sec_strtab], SHT_STRTAB, 0,
+			off[sec_strtab], size[sec_strtab], 0, 0, 1, 0);
+	put_shdr(tail, names[sec_shstrtab], SHT_STRTAB, 0,
+			off[sec_shstrtab], size[sec_shstrtab], 0, 0, 1, 0);
+	put_shdr(tail, names[sec_note], SHT_PROGBITS, 0,
+			off[sec_note], size[sec_note], 0, 0, 1, 0);
+
+	obuf_free(&str);
+	obuf_free(&shstr);
+	free(idx);
+}
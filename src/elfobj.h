@@ -0,0 +1,52 @@
+#ifndef ELFOBJ_H
+#define ELFOBJ_H
+
+#include "obuf.h"
+
+struct elf_sym {
+	char *name;
+	int defined;		/* in .text, at value */
+	int global;
+	long value;
+	long size;
+};
+
+struct elf_rel {
+	long off;			/* of rel32 in .text */
+	int sym;			/* index in syms */
+};
+
+/* Code of symbol sym, that is placed in .text */
+struct elf_func {
+	int sym;
+	long value;
+	long size;
+};
+
+/*
+ * ELF64 relocatable object with a single .text section. Text itself is
+ * not copied here: the file is head, text_len bytes of code and tail.
+ * Functions and relocations may be added before the symbols are known.
+ */
+struct elf_obj {
+	long text_len;
+	struct elf_sym *syms;
+	int syms_len;
+	struct elf_rel *rels;
+	int rels_len;
+	int rels_cap;
+	struct elf_func *funcs;
+	int funcs_len;
+	int funcs_cap;
+};
+
+void elf_init(struct elf_obj *o);
+long elf_add_func(struct elf_obj *o, int sym, long size);
+void elf_add_rel(struct elf_obj *o, long off, int sym);
+void elf_syms_init(struct elf_obj *o, int syms_len);
+int elf_head_size();
+void elf_build(struct elf_obj *o, char *source, struct obuf *head,
+		struct obuf *tail);
+void elf_free(struct elf_obj *o);
+
+#endif
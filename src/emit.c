@@ -1,47 +1,169 @@
+#include <errno.h>
 #include <limits.h>
 #include <alloca.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "global.h"
 #include "func.h"
 #include "alloc.h"
 #include "remap.h"
+#include "x86.h"
 #include "emit.h"
 
-static void asm_push(int op);
-static void asm_pop(int op);
-static void asm_mov_wbreg(int dest, int src, int breg);
-static void asm_mov_num(int dest, long long num);
-static void asm_ret();
-static void asm_jmp(char *lbl);
-static void asm_call(char *func);
-static void asm_cqo();
-
-static void il_add(int dest, int src1, int src2);
-static void il_sub(int dest, int src1, int src2);
-static void il_mul(int dest, int src1, int src2);
-static void il_umul(int dest, int src1, int src2);
-static void il_div(int dest, int src1, int src2);
-static void il_udiv(int dest, int src1, int src2);
-static void il_rem(int dest, int src1, int src2);
-static void il_urem(int dest, int src1, int src2);
-
-static void shift_rsp(int offset);
-
-static void emit_ccall(struct alloc *a, struct command *c);
-static void emit_ccopy(struct alloc *a, struct command *c);
-static void emit_cadd(struct alloc *a, struct command *c);
-static void emit_csub(struct alloc *a, struct command *c);
-static void emit_cmul(struct alloc *a, struct command *c);
-static void emit_cumul(struct alloc *a, struct command *c);
-static void emit_cdiv(struct alloc *a, struct command *c);
-static void emit_cudiv(struct alloc *a, struct command *c);
-static void emit_crem(struct alloc *a, struct command *c);
-static void emit_curem(struct alloc *a, struct command *c);
-static void emit_cret(struct alloc *a, struct command *c);
-
-static void (*emit_cfunc_array[])(struct alloc *a, struct command *c) = {
+#define REG(s) { s, sizeof(s) - 1 }
+
+/* Indexed by register number of alloc.h */
+static const struct {
+	char *str;
+	int len;
+} reg_str[] = {
+	REG("rdi"), REG("rsi"), REG("rdx"), REG("rcx"), REG("r8"), REG("r9"),
+	REG("rbx"), REG("r10"), REG("rax"), REG("r12"), REG("r13"), REG("r14"),
+	REG("r15"), REG("r11"), REG("rsp"), REG("rbp")
+};
+
+#define PUT(e, lit) OBUF_LIT(&(e)->out, lit)
+
+static void put_str(struct emitter *e, char *s)
+{
+	obuf_put(&e->out, s, strlen(s));
+}
+
+/* Same text as op_string gives */
+static void put_op(struct emitter *e, int op, int breg)
+{
+	struct obuf *b = &e->out;
+	if (op < 1000) {
+		obuf_put(b, reg_str[op].str, reg_str[op].len);
+		return;
+	}
+	op -= mem;
+	PUT(e, "[");
+	obuf_put(b, reg_str[breg].str, reg_str[breg].len);
+	if (op > 0)
+		PUT(e, "+");
+	if (op != 0)
+		obuf_putnum(b, op);
+	PUT(e, "]");
+}
+
+#define MN(s) { "\t" s " ", sizeof(s) + 1 }
+
+static const struct {
+	char *str;
+	int len;
+} mnemonic[] = {
+	[x_push] = MN("push"), [x_pop] = MN("pop"), [x_mul] = MN("mul"),
+	[x_imul] = MN("imul"), [x_div] = MN("div"), [x_idiv] = MN("idiv"),
+	[x_mov] = MN("mov"), [x_add] = MN("add"), [x_sub] = MN("sub"),
+	[x_call] = MN("call"), [x_jmp] = MN("jmp"), [x_ret] = MN("ret"),
+	[x_cqo] = MN("cqo")
+};
+
+/* "\t<mn>\n", "\t<mn> <op>\n" and "\t<mn> <op1>, <op2>\n" or their code */
+static void ins0(struct emitter *e, enum x86_ins ins)
+{
+	if (e->bin) {
+		x86_ins0(&e->out, ins);
+		return;
+	}
+	obuf_put(&e->out, mnemonic[ins].str, mnemonic[ins].len - 1);
+	PUT(e, "\n");
+}
+
+/* Size of a memory operand is not implied by anything, nasm wants it */
+static void ins1(struct emitter *e, enum x86_ins ins, int op)
+{
+	if (e->bin) {
+		x86_ins1(&e->out, ins, op, rbp);
+		return;
+	}
+	obuf_put(&e->out, mnemonic[ins].str, mnemonic[ins].len);
+	if (is_mem(op))
+		PUT(e, "qword ");
+	put_op(e, op, rbp);
+	PUT(e, "\n");
+}
+
+static void ins2(struct emitter *e, enum x86_ins ins, int op1, int op2,
+		int breg)
+{
+	if (e->bin) {
+		x86_ins2(&e->out, ins, op1, op2, breg);
+		return;
+	}
+	obuf_put(&e->out, mnemonic[ins].str, mnemonic[ins].len);
+	put_op(e, op1, breg);
+	PUT(e, ", ");
+	put_op(e, op2, breg);
+	PUT(e, "\n");
+}
+
+void emitter_add_reloc(struct emitter *e, long off, int gid)
+{
+	if (e->rel_len == e->rel_cap) {
+		e->rel_cap = e->rel_cap ? e->rel_cap * 2 : 16;
+		e->rel = realloc(e->rel, e->rel_cap * sizeof(struct reloc));
+		if (e->rel == NULL)
+			die("%s\n", strerror(ENOMEM));
+	}
+	e->rel[e->rel_len].off = off;
+	e->rel[e->rel_len].gid = gid;
+	++e->rel_len;
+}
+
+void emitter_init(struct emitter *e, int bin)
+{
+	e->bin = bin;
+	obuf_init(&e->out);
+	e->rel = NULL;
+	e->rel_len = e->rel_cap = 0;
+}
+
+void emitter_free(struct emitter *e)
+{
+	obuf_free(&e->out);
+	free(e->rel);
+	e->rel = NULL;
+	e->rel_len = e->rel_cap = 0;
+}
+
+static void asm_push(struct emitter *e, int op);
+static void asm_pop(struct emitter *e, int op);
+static void asm_mov_wbreg(struct emitter *e, int dest, int src, int breg);
+static void asm_mov_num(struct emitter *e, int dest, long long num);
+static void asm_ret(struct emitter *e);
+static void asm_jmp(struct emitter *e, char *lbl);
+static void asm_call(struct emitter *e, int gid, char *func);
+static void asm_cqo(struct emitter *e);
+
+static void il_add(struct emitter *e, int dest, int src1, int src2);
+static void il_sub(struct emitter *e, int dest, int src1, int src2);
+static void il_mul(struct emitter *e, int dest, int src1, int src2);
+static void il_umul(struct emitter *e, int dest, int src1, int src2);
+static void il_div(struct emitter *e, int dest, int src1, int src2);
+static void il_udiv(struct emitter *e, int dest, int src1, int src2);
+static void il_rem(struct emitter *e, int dest, int src1, int src2);
+static void il_urem(struct emitter *e, int dest, int src1, int src2);
+
+static void shift_rsp(struct emitter *e, int offset);
+
+static void emit_ccall(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_ccopy(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_cadd(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_csub(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_cmul(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_cumul(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_cdiv(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_cudiv(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_crem(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_curem(struct emitter *e, struct alloc *a, struct command *c);
+static void emit_cret(struct emitter *e, struct alloc *a, struct command *c);
+
+static void (*emit_cfunc_array[])(struct emitter *e, struct alloc *a,
+		struct command *c) = {
 	emit_ccall,
 	emit_ccopy,
 	emit_cadd,
@@ -55,423 +177,512 @@ static void (*emit_cfunc_array[])(struct alloc *a, struct command *c) = {
 	emit_cret
 };
 
-static void emit_head(char *f, int offset);
-static void emit_tail();
-static void move(int pos, struct alloc *a, struct command *c);
+static void emit_head(struct emitter *e, char *f, struct alloc *a);
+static void emit_tail(struct emitter *e, struct alloc *a);
+static void resolve_end(struct emitter *e);
+static void move(struct emitter *e, int pos, struct alloc *a,
+		struct command *c);
 
-void asm_emit(struct function *f)
+void asm_emit(struct emitter *e, struct function *f)
 {
 	int pos = 1;
 	struct cmd_list_el *tmp;
 
-	emit_head(f->name, f->alloc_table->st_offset);
+	emit_head(e, f->name, f->alloc_table);
 
 	for (tmp = f->cl->first; tmp; tmp = tmp->next, ++pos) {
-		if (dbg_emit_borders)
-			oprintf("; @cmd %d\n", pos);
-		move(pos, f->alloc_table, &tmp->cmd);
-		emit_cfunc_array[tmp->cmd.type](f->alloc_table, &tmp->cmd);
+		if (DBG(emit_borders) && !e->bin) {
+			PUT(e, "; @cmd ");
+			obuf_putnum(&e->out, pos);
+			PUT(e, "\n");
+		}
+		move(e, pos, f->alloc_table, &tmp->cmd);
+		emit_cfunc_array[tmp->cmd.type](e, f->alloc_table, &tmp->cmd);
 	}
 
-	emit_tail();
+	emit_tail(e, f->alloc_table);
 }
 
-void emit_gn_specs(struct gn_sym_tbl *tb)
+/* Object output takes these from the table itself */
+void emit_gn_specs(struct emitter *e, struct gn_sym_tbl *tb)
 {
 	int i;
+	if (e->bin)
+		return;
 	for (i = 0; i < tb->len; ++i) {
 		int info = tb->vec[i].info;
-		if (info & TBL_GLOBAL)
-			oprintf("global %s\n", tb->vec[i].name);
+		if (info & TBL_GLOBAL) {
+			PUT(e, "global ");
+			put_str(e, tb->vec[i].name);
+			PUT(e, "\n");
+		}
 	}
 
 	for (i = 0; i < tb->len; ++i) {
 		int info = tb->vec[i].info;
-		if ((info & TBL_DEF_HERE) == 0)
-			oprintf("extern %s\n", tb->vec[i].name);
+		if ((info & TBL_DEF_HERE) == 0) {
+			PUT(e, "extern ");
+			put_str(e, tb->vec[i].name);
+			PUT(e, "\n");
+		}
 	}
-	oprintf("\n");
+	PUT(e, "\n");
 }
 
-static void emit_head(char *name, int offset)
+/*
+ * Frame is: arguments on stack, return address, callee-saved registers of
+ * a->saved, rbp of caller, variables on stack (st_offset is negative).
+ */
+static void emit_head(struct emitter *e, char *name, struct alloc *a)
 {
 	int r;
-	oprintf("%s:\n", name);
+	if (!e->bin) {
+		put_str(e, name);
+		PUT(e, ":\n");
+	}
 
-	asm_push(rbx);
-	for (r = r12; r <= r15; ++r)
-		asm_push(r);
-	asm_push(rbp);
+	for (r = 0; r <= r15; ++r) {
+		if (a->saved & 1 << r)
+			asm_push(e, r);
+	}
+	asm_push(e, rbp);
 
-	asm_mov_wbreg(rbp, rsp, rbp);
+	asm_mov_wbreg(e, rbp, rsp, rbp);
 
-	if (offset != 0)
-		shift_rsp(-offset);
+	shift_rsp(e, a->st_offset);
 }
 
-static void emit_tail()
+static void emit_tail(struct emitter *e, struct alloc *a)
 {
 	int r;
-	oprintf("%s:\n", lbl_func_end);
-	asm_mov_wbreg(rsp, rbp, rbp);
+	if (e->bin) {
+		resolve_end(e);
+	} else {
+		put_str(e, lbl_func_end);
+		PUT(e, ":\n");
+	}
+	asm_mov_wbreg(e, rsp, rbp, rbp);
 
-	asm_pop(rbp);
-	for (r = r15; r >= r12; --r)
-		asm_pop(r);
-	asm_pop(rbx);
+	asm_pop(e, rbp);
+	for (r = r15; r >= 0; --r) {
+		if (a->saved & 1 << r)
+			asm_pop(e, r);
+	}
+
+	asm_ret(e);
+	if (!e->bin)
+		PUT(e, "\n");
+}
 
-	asm_ret();
-	oprintf("\n");
+/* Jumps to the end of function are relocations with gid -1 till now */
+static void resolve_end(struct emitter *e)
+{
+	int i, len = 0;
+	for (i = 0; i < e->rel_len; ++i) {
+		struct reloc *r = e->rel + i;
+		if (r->gid == -1)
+			x86_patch32(&e->out, r->off, e->out.len - (r->off + 4));
+		else
+			e->rel[len++] = *r;
+	}
+	e->rel_len = len;
 }
 
-static void move_single(int pos, struct alloc *a, struct cmd_unit *u);
+static void move_var(struct emitter *e, int pos, struct alloc *a, int var,
+		int clean);
 
-static void move(int pos, struct alloc *a, struct command *c)
+static void move(struct emitter *e, int pos, struct alloc *a,
+		struct command *c)
 {
 	int i;
-	for (i = 0; i < c->argnum; ++i)
-		move_single(pos, a, c->args + i);
-	move_single(pos, a, &c->ret_var);
+	for (; a->spills && a->spills->pos == pos; a->spills = a->spills->next)
+		move_var(e, pos, a, a->spills->var, a->spills->clean);
+	for (i = 0; i < c->argnum; ++i) {
+		if (c->args[i].type == 'i')
+			move_var(e, pos, a, c->args[i].id, 0);
+	}
+	if (c->ret_var.type == 'i')
+		move_var(e, pos, a, c->ret_var.id, 0);
 }
 
-static void move_single(int pos, struct alloc *a, struct cmd_unit *u)
+/*
+ * Variable is moved, when it is referred to, so places of phases, that
+ * passed meanwhile, were never taken. Value is still where it was, clean
+ * one is in its slot too, so is not stored, but may be taken back to a
+ * register at the same position.
+ */
+static void move_var(struct emitter *e, int pos, struct alloc *a, int var,
+		int clean)
 {
-	struct var_state *vs;
-	struct alloc_phase *tmp;
+	struct var_state *vs = a->vec + var;
 	int prev_offset;
 
-	if (u->type != 'i')
-		return;
-
-	vs = a->vec + u->id;
 	if (vs->curr->end >= pos)
 		return;
 
-	tmp = vs->curr;
-	prev_offset = tmp->stid;
-
-	assert(vs->curr->next);
-	vs->curr = tmp->next;
-	free(tmp);
-	asm_mov_wbreg(vs->curr->stid, prev_offset, rbp);
+	prev_offset = vs->curr->stid;
+	for (; vs->curr->end < pos; vs->curr = vs->curr->next)
+		assert(vs->curr->next);
+	if (clean == 0 || is_reg(vs->curr->stid))
+		asm_mov_wbreg(e, vs->curr->stid, prev_offset, rbp);
 }
 
-struct args_stack {
-	int offset;
-	int stack[func_max_args];
-};
-
 #define ARG(n) a->vec[c->args[(n)].id].curr
 #define RET a->vec[c->ret_var.id].curr
 
-static void astack_add(struct args_stack *ast, int loc);
-static int astack_get(struct args_stack *ast, int *loc);
+/* Copy of an argument to its register from register, memory or number */
+struct pmove {
+	int dest;
+	int src;				/* -1 if number */
+	long long num;
+};
 
-static void push_func_args(struct alloc *a, struct command *c,
-		struct args_stack *ast, int *offset);
+static void push_func_args(struct emitter *e, struct alloc *a,
+		struct command *c, int pad);
 
-static void emit_ccall(struct alloc *a, struct command *c)
+/*
+ * Only caller-saved registers, that keep variables live across the call
+ * (alloc.c, across_fill), are saved. Register of the result is not, even
+ * if the variable is assigned again. Frame is 16 byte aligned (frame_align),
+ * so is rsp at the call.
+ */
+static void emit_ccall(struct emitter *e, struct alloc *a, struct command *c)
 {
-	struct args_stack ast;
-	int offset = 0;
-	int r;
+	int save = a->across[a->call_next++];
+	int stack = MAX(c->argnum - 1 - 6, 0);
+	int pad, r;
+
+	if (c->ret_var.type == 'i' && is_reg(RET->stid))
+		save &= ~(1 << RET->stid);
+	pad = (__builtin_popcount(save) + stack) & 1;
 
-	ast.offset = -1;
 	for (r = registers_number - 1; r >= 0; --r) {
-		if (r == rbx || (r >= r12 && r <= r15))
-				continue;
-		asm_push(r);
+		if (save & 1 << r)
+			asm_push(e, r);
 	}
 
-	push_func_args(a, c, &ast, &offset);
-	asm_call(c->args[0].str);
-	shift_rsp(-offset);
+	push_func_args(e, a, c, pad);
+	asm_call(e, c->args[0].id, c->args[0].str);
+	shift_rsp(e, 8 * (stack + pad));
+	if (c->ret_var.type == 'i')
+		asm_mov_wbreg(e, RET->stid, rax, rbp);
 
-	for (r = 0; r <= registers_number - 1; ++r) {
-		if (r == rbx || (r >= r12 && r <= r15))
-				continue;
-		asm_pop(r);
+	for (r = 0; r < registers_number; ++r) {
+		if (save & 1 << r)
+			asm_pop(e, r);
 	}
 }
 
-static void push_from_stack(struct args_stack *ast);
+static void arg_get(struct alloc *a, struct command *c, int i,
+		struct pmove *m);
+static void par_move(struct emitter *e, struct pmove *mv, int len);
 
-static void push_func_args(struct alloc *a, struct command *c,
-		struct args_stack *ast, int *offset)
+/*
+ * Arguments after the sixth are pushed first, the rest are loaded to
+ * rdi..r9 at once.
+ */
+static void push_func_args(struct emitter *e, struct alloc *a,
+		struct command *c, int pad)
 {
-	int avail_regs = MIN(6, registers_number);
-	int aregsc = 0;
+	struct pmove mv[6];
+	int len = 0;
 	int i;
-	for (i = 1; i < c->argnum; ++i) {
-		int id = ARG(i)->stid;
-		int src_pos = is_reg(id) ? mem + id * 8 : id;
-
-		if (aregsc < avail_regs) {
-			if (id == rbx || (id >= r10 && id <= 15))
-				asm_mov_wbreg(aregsc, id, rbp);
-			else
-				asm_mov_wbreg(aregsc, src_pos, rsp);
-			++aregsc;
-		} else {
-			*offset += 8;
-			astack_add(ast, src_pos);
+
+	shift_rsp(e, -8 * pad);
+	for (i = c->argnum - 1; i > 6; --i) {
+		arg_get(a, c, i, mv);
+		if (mv->src == -1) {
+			asm_mov_num(e, r11, mv->num);
+			mv->src = r11;
 		}
+		asm_push(e, mv->src);
 	}
-	push_from_stack(ast);
-}
-
-static void push_from_stack(struct args_stack *ast)
-{
-	int loc;
-	while (astack_get(ast, &loc)) {
-		asm_push(loc);
+	for (i = 1; i < c->argnum && i <= 6; ++i) {
+		arg_get(a, c, i, mv + len);
+		mv[len].dest = i - 1;
+		if (mv[len].src != mv[len].dest)
+			++len;
 	}
+	par_move(e, mv, len);
 }
 
-static void astack_add(struct args_stack *ast, int loc)
+static void arg_get(struct alloc *a, struct command *c, int i,
+		struct pmove *m)
 {
-	if (ast->offset == func_max_args - 1)
-		die("internal error\n");
-	ast->stack[++ast->offset] = loc;
+	if (c->args[i].type == 'n') {
+		m->src = -1;
+		m->num = c->args[i].id;
+	} else {
+		m->src = ARG(i)->stid;
+	}
 }
 
-static int astack_get(struct args_stack *ast, int *loc)
+static int is_read(struct pmove *mv, int len, int reg)
 {
-	if (ast->offset == -1)
-		return 0;
-	*loc = ast->stack[ast->offset--];
-	return 1;
+	int i;
+	for (i = 0; i < len && mv[i].src != reg; ++i);
+	return i < len;
+}
+
+/*
+ * Moves are done as if all at once: move is taken, when its destination is
+ * not read by others any more. If there is no such move, what is left are
+ * cycles of registers, one of them is broken by saving a register to r11.
+ */
+static void par_move(struct emitter *e, struct pmove *mv, int len)
+{
+	int i, reg;
+
+	while (len > 0) {
+		for (i = 0; i < len && is_read(mv, len, mv[i].dest); ++i);
+		if (i == len) {
+			reg = mv[0].dest;
+			asm_mov_wbreg(e, r11, reg, rbp);
+			for (i = 0; i < len; ++i) {
+				if (mv[i].src == reg)
+					mv[i].src = r11;
+			}
+			continue;
+		}
+		if (mv[i].src == -1)
+			asm_mov_num(e, mv[i].dest, mv[i].num);
+		else
+			asm_mov_wbreg(e, mv[i].dest, mv[i].src, rbp);
+		mv[i] = mv[--len];
+	}
 }
 
-static void emit_ccopy(struct alloc *a, struct command *c)
+static void emit_ccopy(struct emitter *e, struct alloc *a, struct command *c)
 {
-	if (c->ret_var.type == 'v' || c->ret_var.id == c->args[0].id)
+	if (c->ret_var.type == 'v' ||
+			(c->args[0].type == 'i' && c->ret_var.id == c->args[0].id))
 		return;
 
 	if (c->args[0].type == 'n')
-		asm_mov_num(RET->stid, c->args[0].id);
+		asm_mov_num(e, RET->stid, c->args[0].id);
 	else
-		asm_mov_wbreg(RET->stid, ARG(0)->stid, rbp);
+		asm_mov_wbreg(e, RET->stid, ARG(0)->stid, rbp);
 }
 
-static void emit_cadd(struct alloc *a, struct command *c)
+static void emit_cadd(struct emitter *e, struct alloc *a, struct command *c)
 {
-	il_add(RET->stid, ARG(0)->stid, ARG(1)->stid);
+	il_add(e, RET->stid, ARG(0)->stid, ARG(1)->stid);
 }
 
-static void emit_csub(struct alloc *a, struct command *c)
+static void emit_csub(struct emitter *e, struct alloc *a, struct command *c)
 {
-	il_sub(RET->stid, ARG(0)->stid, ARG(1)->stid);
+	il_sub(e, RET->stid, ARG(0)->stid, ARG(1)->stid);
 }
 
-static void emit_cmul(struct alloc *a, struct command *c)
+static void emit_cmul(struct emitter *e, struct alloc *a, struct command *c)
 {
-	il_mul(RET->stid, ARG(0)->stid, ARG(1)->stid);
+	il_mul(e, RET->stid, ARG(0)->stid, ARG(1)->stid);
 }
 
-static void emit_cumul(struct alloc *a, struct command *c)
+static void emit_cumul(struct emitter *e, struct alloc *a, struct command *c)
 {
-	il_umul(RET->stid, ARG(0)->stid, ARG(1)->stid);
+	il_umul(e, RET->stid, ARG(0)->stid, ARG(1)->stid);
 }
 
-static void emit_cdiv(struct alloc *a, struct command *c)
+static void emit_cdiv(struct emitter *e, struct alloc *a, struct command *c)
 {
-	il_div(RET->stid, ARG(0)->stid, ARG(1)->stid);
+	il_div(e, RET->stid, ARG(0)->stid, ARG(1)->stid);
 }
 
-static void emit_cudiv(struct alloc *a, struct command *c)
+static void emit_cudiv(struct emitter *e, struct alloc *a, struct command *c)
 {
-	il_udiv(RET->stid, ARG(0)->stid, ARG(1)->stid);
+	il_udiv(e, RET->stid, ARG(0)->stid, ARG(1)->stid);
 }
 
-static void emit_crem(struct alloc *a, struct command *c)
+static void emit_crem(struct emitter *e, struct alloc *a, struct command *c)
 {
-	il_rem(RET->stid, ARG(0)->stid, ARG(1)->stid);
+	il_rem(e, RET->stid, ARG(0)->stid, ARG(1)->stid);
 }
 
-static void emit_curem(struct alloc *a, struct command *c)
+static void emit_curem(struct emitter *e, struct alloc *a, struct command *c)
 {
-	il_urem(RET->stid, ARG(0)->stid, ARG(1)->stid);
+	il_urem(e, RET->stid, ARG(0)->stid, ARG(1)->stid);
 }
 
-static void emit_cret(struct alloc *a, struct command *c)
+static void emit_cret(struct emitter *e, struct alloc *a, struct command *c)
 {
 	if (c->argnum == 1)
-		asm_mov_wbreg(rax, ARG(0)->stid, rbp);
-	asm_jmp(lbl_func_end);
+		asm_mov_wbreg(e, rax, ARG(0)->stid, rbp);
+	asm_jmp(e, lbl_func_end);
 }
 
-static void asm_push(int op)
+static void asm_push(struct emitter *e, int op)
 {
-	oprintf("\tpush %s\n", OPS(op, rbp));
+	ins1(e, x_push, op);
 }
 
-static void asm_pop(int op)
+static void asm_pop(struct emitter *e, int op)
 {
-	oprintf("\tpop %s\n", OPS(op, rbp));
+	ins1(e, x_pop, op);
 }
 
-static void asm_mov_num(int dest, long long src);
+static void asm_mov_num(struct emitter *e, int dest, long long src);
 
-static void asm_mov_wbreg(int dest, int src, int breg)
+static void asm_mov_wbreg(struct emitter *e, int dest, int src, int breg)
 {
 	if (dest == src)
 		return;
 
 	if (is_reg(dest) || is_reg(src)) {
-		oprintf("\tmov %s, %s\n", OPS(dest, breg), OPS(src, breg));
+		ins2(e, x_mov, dest, src, breg);
 	} else {
-		oprintf("\tmov %s, %s\n", OPS(rax, breg), OPS(src, breg));
-		oprintf("\tmov %s, %s\n", OPS(dest, breg), OPS(rax, breg));
+		ins2(e, x_mov, r11, src, breg);
+		ins2(e, x_mov, dest, r11, breg);
 	}
 }
 
-static void asm_mov_num(int dest, long long num)
+static void asm_mov_num(struct emitter *e, int dest, long long num)
 {
-	if (num > INT_MAX || num < INT_MIN) {
-		/* nasm can handle this */
-		oprintf("\tmov %s, %d\n", OPS(rax, rbp), num);
-		oprintf("\tmov %s, %s\n", OPS(dest, rbp), OPS(rax, rbp));
+	if (is_mem(dest) && (num > INT_MAX || num < INT_MIN)) {
+		/* Register takes imm64, nasm picks the form itself */
+		asm_mov_num(e, r11, num);
+		asm_mov_wbreg(e, dest, r11, rbp);
+	} else if (e->bin) {
+		x86_mov_imm(&e->out, dest, num, rbp);
 	} else {
 		if (is_reg(dest))
-			oprintf("\tmov %s, %d\n", OPS(dest, rbp), num);
+			PUT(e, "\tmov ");
 		else
-			oprintf("\tmov dword %s, %d\n", OPS(dest, rbp), num);
+			PUT(e, "\tmov qword ");
+		put_op(e, dest, rbp);
+		PUT(e, ", ");
+		obuf_putnum(&e->out, num);
+		PUT(e, "\n");
 	}
 }
 
-static void shift_rsp(int offset)
+static void shift_rsp(struct emitter *e, int offset)
 {
 	if (offset == 0)
 		return;
-	oprintf("\t%s %s, %d\n", offset > 0 ? "add" : "sub",
-			OPS(rsp, -1), abs(offset));
+	if (e->bin) {
+		x86_rsp_add(&e->out, offset);
+		return;
+	}
+	if (offset > 0)
+		PUT(e, "\tadd rsp, ");
+	else
+		PUT(e, "\tsub rsp, ");
+	obuf_putnum(&e->out, abs(offset));
+	PUT(e, "\n");
 }
 
-static void asm_jmp(char *lbl)
+static void asm_jmp(struct emitter *e, char *lbl)
 {
-	oprintf("\tjmp %s\n", lbl);
+	if (e->bin) {
+		/* Only jumps to lbl_func_end are emitted */
+		emitter_add_reloc(e, x86_rel32(&e->out, x_jmp), -1);
+		return;
+	}
+	PUT(e, "\tjmp ");
+	put_str(e, lbl);
+	PUT(e, "\n");
 }
 
-static void asm_ret()
+static void asm_ret(struct emitter *e)
 {
-	oprintf("\tret\n");
+	ins0(e, x_ret);
 }
 
-static void asm_call(char *func)
+static void asm_call(struct emitter *e, int gid, char *func)
 {
-	oprintf("\tcall %s\n", func);
+	if (e->bin) {
+		emitter_add_reloc(e, x86_rel32(&e->out, x_call), gid);
+		return;
+	}
+	PUT(e, "\tcall ");
+	put_str(e, func);
+	PUT(e, "\n");
 }
 
-static void asm_cqo()
+static void asm_cqo(struct emitter *e)
 {
-	oprintf("\tcqo\n");
+	ins0(e, x_cqo);
 }
 
-static void il_add(int dest, int src1, int src2)
+static void il_add(struct emitter *e, int dest, int src1, int src2)
 {
 	if (is_reg(dest) || (is_reg(src1) && is_reg(src2))) {
-		asm_mov_wbreg(dest, src1, rbp);
-		oprintf("\tadd %s, %s\n", OPS(dest, rbp), OPS(src2, rbp));
+		asm_mov_wbreg(e, dest, src1, rbp);
+		ins2(e, x_add, dest, src2, rbp);
 	} else {
-		asm_mov_wbreg(rax, src1, rbp);
-		oprintf("\tadd %s, %s\n", OPS(rax, rbp), OPS(src2, rbp));
-		asm_mov_wbreg(dest, rax, rbp);
+		asm_mov_wbreg(e, r11, src1, rbp);
+		ins2(e, x_add, r11, src2, rbp);
+		asm_mov_wbreg(e, dest, r11, rbp);
 	}
 }
 
-static void il_sub(int dest, int src1, int src2)
+static void il_sub(struct emitter *e, int dest, int src1, int src2)
 {
 	if (is_reg(dest) || (is_reg(src1) && is_reg(src2))) {
-		asm_mov_wbreg(dest, src1, rbp);
-		oprintf("\tsub %s, %s\n", OPS(dest, rbp), OPS(src2, rbp));
+		asm_mov_wbreg(e, dest, src1, rbp);
+		ins2(e, x_sub, dest, src2, rbp);
 	} else {
-		asm_mov_wbreg(rax, src1, rbp);
-		oprintf("\tsub %s, %s\n", OPS(rax, rbp), OPS(src2, rbp));
-		asm_mov_wbreg(dest, rax, rbp);
+		asm_mov_wbreg(e, r11, src1, rbp);
+		ins2(e, x_sub, r11, src2, rbp);
+		asm_mov_wbreg(e, dest, r11, rbp);
 	}
 }
 
-static void il_mul(int dest, int src1, int src2)
-{
-	if (dest != rdx)
-		asm_push(rdx);
-
-	asm_mov_wbreg(rax, src1, rbp);
-	oprintf("\timul %s\n",  OPS(src2, rbp));
-	asm_mov_wbreg(dest, rax, rbp);
-
-	if (dest != rdx)
-		asm_pop(rdx);
+/*
+ * Allocator keeps variables, that live across multiplication or division,
+ * out of rax and rdx (alloc.c, fixed_clobbers), only the operands, that
+ * die here, and the result may be there. Divisor is read after rdx is
+ * set, so it is taken to r11 from rax or rdx.
+ */
+static void il_muldiv(struct emitter *e, int ins, int dest, int src1,
+		int src2, int res)
+{
+	int tmp;
+
+	if (src2 == rax && (ins == x_imul || ins == x_mul)) {
+		tmp = src1;
+		src1 = src2;
+		src2 = tmp;
+	} else if (src2 == rax || src2 == rdx) {
+		asm_mov_wbreg(e, r11, src2, rbp);
+		src2 = r11;
+	}
+	asm_mov_wbreg(e, rax, src1, rbp);
+	if (ins == x_idiv)
+		asm_cqo(e);
+	else if (ins == x_div)
+		asm_mov_num(e, rdx, 0);
+	ins1(e, ins, src2);
+	asm_mov_wbreg(e, dest, res, rbp);
 }
 
-static void il_umul(int dest, int src1, int src2)
+static void il_mul(struct emitter *e, int dest, int src1, int src2)
 {
-	if (dest != rdx)
-		asm_push(rdx);
-
-	asm_mov_wbreg(rax, src1, rbp);
-	oprintf("\tmul %s\n",  OPS(src2, rbp));
-	asm_mov_wbreg(dest, rax, rbp);
-
-	if (dest != rdx)
-		asm_pop(rdx);
+	il_muldiv(e, x_imul, dest, src1, src2, rax);
 }
 
-static void il_div(int dest, int src1, int src2)
+static void il_umul(struct emitter *e, int dest, int src1, int src2)
 {
-	if (dest != rdx)
-		asm_push(rdx);
-
-	asm_mov_wbreg(rax, src1, rbp);
-	asm_cqo();
-	oprintf("\tidiv %s\n",  OPS(src2, rbp));
-	asm_mov_wbreg(dest, rax, rbp);
-
-	if (dest != rdx)
-		asm_pop(rdx);
+	il_muldiv(e, x_mul, dest, src1, src2, rax);
 }
 
-static void il_udiv(int dest, int src1, int src2)
+static void il_div(struct emitter *e, int dest, int src1, int src2)
 {
-	if (dest != rdx)
-		asm_push(rdx);
-
-	asm_mov_wbreg(rax, src1, rbp);
-	asm_mov_num(rdx, 0);
-	oprintf("\tdiv %s\n",  OPS(src2, rbp));
-	asm_mov_wbreg(dest, rax, rbp);
-
-	if (dest != rdx)
-		asm_pop(rdx);
+	il_muldiv(e, x_idiv, dest, src1, src2, rax);
 }
 
-static void il_rem(int dest, int src1, int src2)
+static void il_udiv(struct emitter *e, int dest, int src1, int src2)
 {
-	if (dest != rdx)
-		asm_push(rdx);
-
-	asm_mov_wbreg(rax, src1, rbp);
-	asm_cqo();
-	oprintf("\tidiv %s\n",  OPS(src2, rbp));
-	if (dest != rdx)
-		asm_mov_wbreg(dest, rdx, rbp);
-
-	if (dest != rdx)
-		asm_pop(rdx);
+	il_muldiv(e, x_div, dest, src1, src2, rax);
 }
 
-static void il_urem(int dest, int src1, int src2)
+static void il_rem(struct emitter *e, int dest, int src1, int src2)
 {
-	if (dest != rdx)
-		asm_push(rdx);
-
-	asm_mov_wbreg(rax, src1, rbp);
-	asm_mov_num(rdx, 0);
-	oprintf("\tdiv %s\n",  OPS(src2, rbp));
-	if (dest != rdx)
-		asm_mov_wbreg(dest, rdx, rbp);
+	il_muldiv(e, x_idiv, dest, src1, src2, rdx);
+}
 
-	if (dest != rdx)
-		asm_pop(rdx);
+static void il_urem(struct emitter *e, int dest, int src1, int src2)
+{
+	il_muldiv(e, x_div, dest, src1, src2, rdx);
 }
@@ -1,9 +1,33 @@
 #ifndef EMIT_H
 #define EMIT_H
 
+#include "obuf.h"
+
 struct function;
+struct gn_sym_tbl;
+
+/* Position of rel32 in code, that refers to global name gid */
+struct reloc {
+	long off;
+	int gid;
+};
+
+/*
+ * Assembly text or machine code of one translation unit or of one
+ * function. Code refers to other functions through relocations.
+ */
+struct emitter {
+	int bin;
+	struct obuf out;
+	struct reloc *rel;
+	int rel_len;
+	int rel_cap;
+};
 
-void emit_gn_specs(struct gn_sym_tbl *tb);
-void asm_emit(struct function *f);
+void emitter_init(struct emitter *e, int bin);
+void emitter_free(struct emitter *e);
+void emitter_add_reloc(struct emitter *e, long off, int gid);
+void emit_gn_specs(struct emitter *e, struct gn_sym_tbl *tb);
+void asm_emit(struct emitter *e, struct function *f);
 
 #endif
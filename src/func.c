@@ -1,5 +1,3 @@
-#include <errno.h>
-#include <limits.h>
 #include <alloca.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -30,15 +28,10 @@ static const char *func_arg_dup = "function argument duplicate";
 static const char *func_too_many_args = "too many arguments";
 
 static const char *msg_too_many_args = "too many arguments\n";
-static const char *msg_underflow = "underflow detected";
-static const char *msg_overflow = "overflow detected";
 
-struct cmd_list *cmd_list_init();
+struct cmd_list *cmd_list_init(struct arena *ar);
 void cmd_list_add(struct cmd_list *l, struct command *c);
 
-void fcall_list_add(struct fcall_list *l, int fid, char *pat,
-		struct coord *pos);
-
 
 static void set_gn_entry(struct gn_tbl_entry *e, struct coord *pos, int gl,
 		char type, int argnum);
@@ -64,20 +57,28 @@ void func_header_form(struct lexem_list *l, struct function *f,
 		f->type = 0;
 	}
 	tmp = tb->vec + b.dt.number;
+	f->gid = b.dt.number;
+	f->gl_spec = gl_spec;
 	f->name = tmp->name;
 	f->pos = b.crd;
 
 	lexem_clever_get(l, &b, ltvec3, 1);
 	fdecl_eat_args(l, f);
 	lexem_clever_get(l, &b, ltvec4, 1);
-	set_gn_entry(tmp, &f->pos, gl_spec, f->type, f->argnum);
 	debug_function_header(f, gl_spec);
 }
 
-static char *form_pattern(char rt, struct cmd_unit *args, int argnum)
+void func_header_register(struct function *f, struct gn_sym_tbl *tb)
+{
+	set_gn_entry(tb->vec + f->gid, &f->pos, f->gl_spec, f->type, f->argnum);
+}
+
+/* Pattern is taken from ar or from heap, if ar is NULL */
+static char *form_pattern(struct arena *ar, char rt, struct cmd_unit *args,
+		int argnum)
 {
 	int i;
-	char *tmp = smalloc(3 + argnum);
+	char *tmp = ar ? arena_alloc(ar, 3 + argnum) : smalloc(3 + argnum);
 
 	tmp[0] = rt;
 	tmp[1] = ':';
@@ -102,7 +103,7 @@ static void set_gn_entry(struct gn_tbl_entry *e, struct coord *pos, int gl,
 	e->info = TBL_FUNC | TBL_DEF_HERE;
 	if (gl)
 		e->info |= TBL_GLOBAL;
-	e->type_pattern = form_pattern(type, NULL, argnum);
+	e->type_pattern = form_pattern(NULL, type, NULL, argnum);
 }
 
 static int fdecl_eat_arg(struct lexem_list *l, int anum, struct function *f);
@@ -142,9 +143,9 @@ static int fdecl_eat_arg(struct lexem_list *l, int anum, struct function *f)
 
 static void debug_function_header(struct function *f, int gl)
 {
-	if (dbg_function_header == 0)
+	if (DBG(function_header) == 0)
 		return;
-	eprintf("--Function: %s\'%s\' [%d]--\n\n",
+	dbg_printf("--Function: %s\'%s\' [%d]--\n\n",
 			gl ? "global " : "", f->name, f->argnum);
 }
 
@@ -169,7 +170,7 @@ static void debug_commands(struct cmd_list *l, struct gn_sym_tbl *tb);
 static void cmd_primal_form(struct lexem_list *l, struct function *f,
 		struct gn_sym_tbl *tb)
 {
-	struct cmd_list *cl = cmd_list_init();
+	struct cmd_list *cl = cmd_list_init(&f->ar);
 	while (cmd_extract(l, cl, tb));
 	debug_commands(cl, tb);
 	f->cl = cl;
@@ -178,7 +179,7 @@ static void cmd_primal_form(struct lexem_list *l, struct function *f,
 static int eat_dest(struct lexem_list *l, struct lexem_block *b);
 static void eat_cmd(struct lexem_list *l, struct lexem_block *b);
 static void cmd_eat_args(struct lexem_list *l, struct command *c,
-		struct gn_sym_tbl *tbl);
+		struct gn_sym_tbl *tbl, struct arena *ar);
 
 static int cmd_extract(struct lexem_list *l, struct cmd_list *cl,
 		struct gn_sym_tbl *tbl)
@@ -201,7 +202,7 @@ static int cmd_extract(struct lexem_list *l, struct cmd_list *cl,
 	cmd.pos = b.crd;
 	cmd.type = b.lt - 1000;
 
-	cmd_eat_args(l, &cmd, tbl);
+	cmd_eat_args(l, &cmd, tbl, cl->ar);
 	cmd_list_add(cl, &cmd);
 	return 1;
 }
@@ -236,7 +237,7 @@ static int __eat_args(struct lexem_list *l, struct command *c,
 		enum lexem_type end, struct cmd_unit *argbuf);
 
 static void cmd_eat_args(struct lexem_list *l, struct command *c,
-		struct gn_sym_tbl *tbl)
+		struct gn_sym_tbl *tbl, struct arena *ar)
 {
 	/* +1 since function name is first argument of call command */
 	struct cmd_unit argbuf[func_max_args + 1];
@@ -261,11 +262,11 @@ static void cmd_eat_args(struct lexem_list *l, struct command *c,
 
 	c->argnum = argbuf_pos;
 	if (c->argnum > 0) {
-		c->args = smalloc(c->argnum * sizeof(struct cmd_unit));
+		c->args = arena_alloc(ar, c->argnum * sizeof(struct cmd_unit));
 		memcpy(c->args, argbuf, c->argnum * sizeof(struct cmd_unit));
 	}
 
-	c->pat = form_pattern(c->ret_var.type, c->args + is_call,
+	c->pat = form_pattern(ar, c->ret_var.type, c->args + is_call,
 			c->argnum - is_call);
 }
 
@@ -290,8 +291,6 @@ static int __eat_args(struct lexem_list *l, struct command *c,
 	return i;
 }
 
-static long long convert_number(char *s, struct coord *pos);
-
 static int __eat_arg(struct lexem_list *l, enum lexem_type end,
 		struct cmd_unit *arg, int *pos)
 {
@@ -303,14 +302,13 @@ static int __eat_arg(struct lexem_list *l, enum lexem_type end,
 		if (*pos == 0)
 			return 0;
 		die("%d,%d: %s - expected %s or %s, not %s\n", b.crd.row, b.crd.col,
-				LNAME(lx_number, 0, NULL),
-				LNAME(lx_var_remapped, 0, NULL),
-				LNAME(end, 0, NULL));
+				LNAME(lx_number),
+				LNAME(lx_var_remapped),
+				LNAME(end));
 		break;
 	case 1:
 		arg->type = 'n';
-		arg->id = convert_number(b.dt.str_value, &b.crd);
-		free(b.dt.str_value);
+		arg->id = b.dt.value;
 		break;
 	case 2:
 		arg->type = 'i';
@@ -321,41 +319,29 @@ static int __eat_arg(struct lexem_list *l, enum lexem_type end,
 	return lexem_clever_get(l, &b, vec2, 2);
 }
 
-static long long convert_number(char *s, struct coord *pos)
-{
-	long long res = strtoll(s, NULL, 10);
-	if (errno == ERANGE) {
-		if (res == LLONG_MAX)
-			die("%d,%d:\'%s\': %s\n", pos->row, pos->col, s, msg_overflow);
-		else
-			die("%d,%d:\'%s\': %s\n", pos->row, pos->col, s, msg_underflow);
-	}
-	return res;
-}
-
 static void debug_print_arg(struct cmd_unit *u, int last);
 
 static void debug_commands(struct cmd_list *l, struct gn_sym_tbl *tb)
 {
 	struct cmd_list_el *tmp;
-	if (dbg_commands == 0)
+	if (DBG(commands) == 0)
 		return;
-	eprintf("--Commands--\n");
+	dbg_printf("--Commands--\n");
 	for (tmp = l->first; tmp; tmp = tmp->next) {
 		int i;
 		if (tmp->cmd.ret_var.type == 'i')
-			eprintf("  [%lld]\t", tmp->cmd.ret_var.id);
+			dbg_printf("  [%lld]\t", tmp->cmd.ret_var.id);
 		else
-			eprintf("  \t");
+			dbg_printf("  \t");
 
-		eprintf("%s(%s):\t", LNAME(tmp->cmd.type + 1000, 0, NULL),
+		dbg_printf("%s(%s):\t", LNAME(tmp->cmd.type + 1000),
 				tmp->cmd.pat);
 
 		for (i = 0; i < tmp->cmd.argnum; ++i) {
 			debug_print_arg(tmp->cmd.args + i,
 					i + 1 == tmp->cmd.argnum);
 		}
-		eprintf("\n");
+		dbg_printf("\n");
 	}
 }
 
@@ -363,16 +349,16 @@ static void debug_print_arg(struct cmd_unit *u, int last)
 {
 	switch(u->type) {
 	case 'n':
-		eprintf("%lld", u->id);
+		dbg_printf("%lld", u->id);
 		break;
 	case 'i':
-		eprintf("[%lld]", u->id);
+		dbg_printf("[%lld]", u->id);
 		break;
 	case 'g':
-		eprintf("$%s", u->str);
+		dbg_printf("$%s", u->str);
 		break;
 	}
-	eprintf(!last ?  ", " : "");
+	dbg_printf(!last ?  ", " : "");
 }
 
 struct acheck_tbl {
@@ -426,7 +412,6 @@ static void type_validity_check(struct cmd_list *l, struct fcall_list *fcl)
 		if (tmp->cmd.type != cmd_call) {
 			char *template = tv_check_args(&tmp->cmd);
 			tv_check_ret(template[0], &tmp->cmd);
-			free(tmp->cmd.pat);
 		} else {
 			fcall_list_add(fcl, tmp->cmd.args[0].id, tmp->cmd.pat, &tmp->cmd.pos);
 		}
@@ -442,7 +427,7 @@ static char *tv_check_args(struct command *c)
 			return tmp[i];
 	}
 	die("%d: %s - invalid pattern (%s)\n", c->pos.row,
-			LNAME(c->type + 1000, 0, NULL), c->pat);
+			LNAME(c->type + 1000), c->pat);
 	return NULL;
 }
 
@@ -450,17 +435,16 @@ static void tv_check_ret(char rtype, struct command *c)
 {
 	if (rtype == 'i' && c->ret_var.type == 'v')
 		warn("%d,%d: %s - return value ignored\n", c->pos.row, c->pos.col,
-				LNAME(c->type + 1000, 0, NULL));
+				LNAME(c->type + 1000));
 	if (rtype == 'v' && c->ret_var.type == 'i')
 		die("%d,%d: %s - void assignment\n", c->pos.row, c->pos.col,
-				LNAME(c->type + 1000, 0, NULL));
+				LNAME(c->type + 1000));
 }
 
 static int not_set(struct gn_sym_tbl *tb, int id);
 static void set(struct gn_sym_tbl *tb, int id, struct coord *pos,
 		char *pat);
 static void check(struct fcall_list_el *t, struct gn_tbl_entry *e);
-static void fcall_list_free(struct fcall_list *l);
 
 void check_functions(struct gn_sym_tbl *tb, struct fcall_list *fcl)
 {
@@ -472,7 +456,7 @@ void check_functions(struct gn_sym_tbl *tb, struct fcall_list *fcl)
 			check(tmp, tb->vec + tmp->fid);
 	}
 
-	if (dbg_free_all_mem)
+	if (ctx_cur->free_all_mem)
 		fcall_list_free(fcl);
 }
 
@@ -508,33 +492,21 @@ static void check(struct fcall_list_el *t, struct gn_tbl_entry *e)
 	}
 }
 
-void cmd_list_free(struct cmd_list *l)
+struct cmd_list *cmd_list_init(struct arena *ar)
 {
-	struct cmd_list_el *tmp;
-	while (l->first) {
-		tmp = l->first;
-		l->first = tmp->next;
-
-		if (tmp->cmd.argnum > 0)
-			free(tmp->cmd.args);
-		free(tmp);
-	}
-	free(l);
-}
-
-struct cmd_list *cmd_list_init()
-{
-	struct cmd_list *tmp = smalloc(sizeof(struct cmd_list));
+	struct cmd_list *tmp = arena_alloc(ar, sizeof(struct cmd_list));
 	tmp->first = tmp->last = NULL;
+	tmp->ar = ar;
 	return tmp;
 }
 
 void cmd_list_add(struct cmd_list *l, struct command *c)
 {
+	struct cmd_list_el *tmp = arena_alloc(l->ar, sizeof(struct cmd_list_el));
 	if (l->first == NULL)
-		l->first = l->last = smalloc(sizeof(struct cmd_list_el));
+		l->first = l->last = tmp;
 	else
-		l->last = l->last->next = smalloc(sizeof(struct cmd_list_el));
+		l->last = l->last->next = tmp;
 	l->last->next = NULL;
 	l->last->cmd = *c;
 }
@@ -545,7 +517,8 @@ void fcall_list_add(struct fcall_list *l, int fid, char *pat,
 	struct fcall_list_el *tmp = smalloc(sizeof(struct fcall_list_el));
 	tmp->fid = fid;
 	tmp->pos = *pos;
-	tmp->pattern = pat;
+	/* Outlives the function, that pat belongs to */
+	tmp->pattern = sstrdup(pat);
 	tmp->next = NULL;
 	if (l->first == NULL)
 		l->first = l->last = tmp;
@@ -553,7 +526,7 @@ void fcall_list_add(struct fcall_list *l, int fid, char *pat,
 		l->last = l->last->next = tmp;
 }
 
-static void fcall_list_free(struct fcall_list *l)
+void fcall_list_free(struct fcall_list *l)
 {
 	struct fcall_list_el *tmp;
 	while (l->first) {
@@ -568,11 +541,11 @@ static void fcall_list_free(struct fcall_list *l)
 void debug_fcall_list(struct fcall_list *l, struct gn_sym_tbl *tb)
 {
 	struct fcall_list_el *tmp;
-	if (dbg_fcall_list == 0)
+	if (DBG(fcall_list) == 0)
 		return;
-	eprintf("\n----Function call list----\n");
+	dbg_printf("\n----Function call list----\n");
 	for (tmp = l->first; tmp; tmp = tmp->next) {
-		eprintf("\t%s: [%d, %d] %s\n", tb->vec[tmp->fid].name,
+		dbg_printf("\t%s: [%d, %d] %s\n", tb->vec[tmp->fid].name,
 				tmp->pos.row, tmp->pos.col, tmp->pattern);
 	}
 }
@@ -3,6 +3,7 @@
 
 #include "remap.h"
 #include "lparse.h"
+#include "arena.h"
 
 enum {
 	cmd_call,
@@ -48,6 +49,7 @@ struct cmd_list_el {
 struct cmd_list {
 	struct cmd_list_el *first;
 	struct cmd_list_el *last;
+	struct arena *ar;
 };
 
 struct function {
@@ -55,10 +57,13 @@ struct function {
 	struct coord pos;
 
 	char type;
+	char gl_spec;
+	int gid;
 	int argnum;
 	struct var_sym_tbl stb;
 	struct cmd_list *cl;
 	struct alloc *alloc_table;
+	struct arena ar; /* commands and allocation tables live here */
 };
 
 struct fcall_list_el {
@@ -75,9 +80,12 @@ struct fcall_list {
 
 void func_header_form(struct lexem_list *l, struct function *f,
 		int gl_spec, struct gn_sym_tbl *tb);
+void func_header_register(struct function *f, struct gn_sym_tbl *tb);
 void cmd_form(struct lexem_list *l, struct function *f,
 		struct gn_sym_tbl *tb, struct fcall_list *cl);
-void cmd_list_free(struct cmd_list *l);
+void fcall_list_add(struct fcall_list *l, int fid, char *pat,
+		struct coord *pos);
+void fcall_list_free(struct fcall_list *l);
 void debug_fcall_list(struct fcall_list *l, struct gn_sym_tbl *tb);
 void check_functions(struct gn_sym_tbl *tb, struct fcall_list *fcl);
 #endif
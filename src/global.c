@@ -1,3 +1,4 @@
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -5,41 +6,53 @@
 
 #include "global.h"
 
-char dbg_acts_start = 1;
-char dbg_settings = 1;
-char dbg_global_lexem_parse = 1;
-char dbg_gn_borders = 1;
-char dbg_function_header = 1;
-char dbg_vars_remapped = 1;
-char dbg_commands = 1;
-char dbg_lifespan = 1;
-char dbg_allocation = 1;
-char dbg_fcall_list = 1;
-char dbg_gn_pre = 1;
-char dbg_gn_post = 1;
-char dbg_emit_borders = 1;
-
-char dbg_free_all_mem = 1;
-
 static const char *error_prefix = "error";
 static const char *warn_prefix = "warning";
 static const char *malloc_failed = "malloc failure";
 
+enum {
+	diag_max_len = 1024
+};
+
 const char *lbl_func_end = ".end";
 
-FILE *output_file = NULL;
+__thread jmp_buf *die_recover = NULL;
+__thread char *diag_file = NULL;
+
 
+/* Diagnostic is kept in the current context and printed unless quiet */
 static void inform(int mode, char *fmt, va_list vl)
 {
+	char msg[diag_max_len];
 	char *prx;
+	int len;
 	if (mode == 1)
 		prx = error_prefix;
 	else
 		prx = warn_prefix;
-	eprintf("%s:", prx);
-	vfprintf(stderr, fmt, vl);
+	len = vsnprintf(msg, sizeof(msg), fmt, vl);
+	if (len > 0 && len < sizeof(msg) && msg[len - 1] == '\n')
+		msg[len - 1] = 0;
+	ctx_diag_add(ctx_cur, mode == 1 ? diag_error : diag_warning,
+			diag_file, msg);
+	if (ctx_cur->quiet == 0) {
+		/* Debug output, that led to the diagnostic, goes first */
+		fflush(dbg_stream());
+		flockfile(stderr);
+		if (diag_file)
+			eprintf("%s:", diag_file);
+		eprintf("%s:%s\n", prx, msg);
+		funlockfile(stderr);
+	}
 	if (mode == 1)
-		exit(1);
+		fail();
+}
+
+void fail()
+{
+	if (die_recover)
+		longjmp(*die_recover, 1);
+	exit(1);
 }
 
 void die(char *fmt, ...)
@@ -58,11 +71,16 @@ void warn(char *fmt, ...)
 	va_end(vl);
 }
 
+/* Counters are shared by workers, so they are touched only if reported */
 void *smalloc(int size)
 {
 	void *tmp = malloc(size);
 	if (tmp == NULL)
 		die("%s\n", malloc_failed);
+	if (__builtin_expect(ctx_cur->time_report, 0)) {
+		__atomic_add_fetch(&ctx_cur->alloc_calls, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&ctx_cur->alloc_bytes, size, __ATOMIC_RELAXED);
+	}
 	return tmp;
 }
 
@@ -1,30 +1,23 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
 
-extern char dbg_acts_start;
-extern char dbg_settings;
-extern char dbg_global_lexem_parse;
-extern char dbg_gn_borders;
-extern char dbg_function_header;
-extern char dbg_vars_remapped;
-extern char dbg_commands;
-extern char dbg_lifespan;
-extern char dbg_allocation;
-extern char dbg_fcall_list;
-extern char dbg_gn_pre;
-extern char dbg_gn_post;
-extern char dbg_emit_borders;
+#include "ctx.h"
 
-extern char dbg_free_all_mem;
 
-extern FILE *output_file;
 
 extern const char *lbl_func_end;
 
-#define MIN(a, b) ((a) > (b) ? (a) : (b))
+/* If set, fail and die return there instead of exiting */
+extern __thread jmp_buf *die_recover;
+/* Prefix of diagnostics, name of the file being compiled */
+extern __thread char *diag_file;
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 static inline void eprintf(char *fmt, ...)
 {
@@ -34,14 +27,16 @@ static inline void eprintf(char *fmt, ...)
 	va_end(vl);
 }
 
-static inline void oprintf(char *fmt, ...)
+/* Debug output, see DBG */
+static inline void dbg_printf(char *fmt, ...)
 {
 	va_list vl;
 	va_start(vl, fmt);
-	vfprintf(output_file, fmt, vl);
+	vfprintf(dbg_stream(), fmt, vl);
 	va_end(vl);
 }
 
+void fail();
 void die(char *fmt, ...);
 void warn(char *fmt, ...);
 void *smalloc(int size);
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "input.h"
+
+static void input_read(struct input *in, int fd, char *filename);
+
+void input_open(struct input *in, char *filename)
+{
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd == -1)
+		die("%s: %s\n", filename, strerror(errno));
+	if (fstat(fd, &st) == -1) {
+		int err = errno;
+		close(fd);
+		die("%s: %s\n", filename, strerror(err));
+	}
+
+	in->data = NULL;
+	in->len = 0;
+	in->mapped = 0;
+	in->dropped = 0;
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *tmp = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (tmp != MAP_FAILED) {
+			madvise(tmp, st.st_size, MADV_SEQUENTIAL);
+			in->data = tmp;
+			in->len = st.st_size;
+			in->mapped = 1;
+		}
+	}
+	/* Pipes, terminals and everything mmap refused */
+	if (in->mapped == 0)
+		input_read(in, fd, filename);
+
+	if (close(fd) == -1)
+		die("%s: %s\n", filename, strerror(errno));
+}
+
+/* Source, that is already in memory, caller keeps its buffer */
+void input_copy(struct input *in, const char *s, long len)
+{
+	in->data = smalloc(len > 0 ? len : 1);
+	memcpy(in->data, s, len);
+	in->len = len;
+	in->mapped = 0;
+	in->dropped = 0;
+}
+
+static void input_read(struct input *in, int fd, char *filename)
+{
+	long size = input_chunk;
+	ssize_t got;
+
+	in->data = smalloc(size);
+	for (;;) {
+		if (in->len == size) {
+			size *= 2;
+			in->data = realloc(in->data, size);
+			if (in->data == NULL)
+				die("%s: %s\n", filename, strerror(ENOMEM));
+		}
+		got = read(fd, in->data + in->len, size - in->len);
+		if (got == 0)
+			break;
+		if (got == -1) {
+			if (errno == EINTR)
+				continue;
+			die("%s: %s\n", filename, strerror(errno));
+		}
+		in->len += got;
+	}
+}
+
+/*
+ * Data before off is not read any more. Pages of mapped input are given
+ * back, so the resident part of a long file stays small.
+ */
+void input_drop(struct input *in, long off)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	off &= ~(page - 1);
+	if (in->mapped == 0 || off <= in->dropped)
+		return;
+	madvise(in->data + in->dropped, off - in->dropped, MADV_DONTNEED);
+	in->dropped = off;
+}
+
+void input_close(struct input *in)
+{
+	if (in->mapped)
+		munmap(in->data, in->len);
+	else
+		free(in->data);
+	in->data = NULL;
+	in->len = 0;
+}
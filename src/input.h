@@ -0,0 +1,20 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+enum {
+	input_chunk = 1 << 20
+};
+
+struct input {
+	char *data;
+	long len;
+	int mapped; /* 1 if data is mmap'ed, 0 if it is malloc'ed */
+	long dropped;	/* data before it is given back, see input_drop */
+};
+
+void input_open(struct input *in, char *filename);
+void input_copy(struct input *in, const char *s, long len);
+void input_drop(struct input *in, long off);
+void input_close(struct input *in);
+
+#endif
@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "global.h"
+#include "lparse.h"
+#include "remap.h"
+#include "process.h"
+#include "x86.h"
+#include "obuf.h"
+#include "jit.h"
+
+static const char *msg_no_extern = "extern function is not found";
+static const char *perf_map_fmt = "/tmp/perf-%d.map";
+
+/* Function of the module, off is from the start of code */
+struct jit_sym {
+	char *name;
+	long off;
+	long size;
+	int global;
+};
+
+struct ilc_jit {
+	char *code;				/* mmap'ed, read and execute only */
+	long len;
+	struct jit_sym *syms;
+	int syms_len;
+};
+
+static void code_form(struct state *st, struct obuf *code,
+		ilc_lookup lookup, void *arg);
+static void syms_form(struct ilc_jit *j, struct state *st);
+static void code_map(struct ilc_jit *j, struct obuf *code);
+static void perf_map_write(struct ilc_jit *j);
+
+/*
+ * Returns NULL on error, diagnostics are in the context then. Memory of
+ * the failed module is freed, as process does.
+ */
+struct ilc_jit *ilc_jit_compile(struct ctx *c, const char *src, long len,
+		ilc_lookup lookup, void *arg)
+{
+	struct state st;
+	struct obuf code;
+	struct ilc_jit *j;
+	jmp_buf env;
+	jmp_buf *prev = die_recover;
+	struct ctx *prev_ctx = ctx_cur;
+
+	j = malloc(sizeof(struct ilc_jit));
+	if (j == NULL)
+		return NULL;
+	memset(j, 0, sizeof(struct ilc_jit));
+	memset(&st, 0, sizeof(struct state));
+	st.ctx = c;
+	st.out = -1;
+	st.bin = 1;
+	ctx_cur = c;
+	obuf_init(&code);
+	die_recover = &env;
+	if (setjmp(env)) {
+		obuf_free(&code);
+		module_free(&st);
+		die_recover = prev;
+		ctx_cur = prev_ctx;
+		ilc_jit_free(j);
+		return NULL;
+	}
+
+	module_parse(&st, lexem_parse_string(src, len));
+	module_compile(&st, c->jobs);
+	module_link(&st);
+
+	code_form(&st, &code, lookup, arg);
+	syms_form(j, &st);
+	code_map(j, &code);
+	obuf_free(&code);
+	perf_map_write(j);
+
+	if (c->free_all_mem)
+		module_free(&st);
+	die_recover = prev;
+	ctx_cur = prev_ctx;
+	return j;
+}
+
+/*
+ * Functions go one after another in source order. Externs may be out of
+ * reach of rel32, so they are called through stubs after the functions.
+ */
+static void code_form(struct state *st, struct obuf *code,
+		ilc_lookup lookup, void *arg)
+{
+	struct gn_sym_tbl *tb = &st->global_tbl;
+	long *pos = smalloc((tb->len + 1) * sizeof(long));
+	int i, k;
+
+	for (i = 0; i < st->jobs_len; ++i) {
+		struct job *jb = st->jobs + i;
+		pos[jb->f->gid] = code->len;
+		obuf_put(code, jb->em.out.buf, jb->em.out.len);
+	}
+	for (i = 0; i < tb->len; ++i) {
+		void *addr;
+		if (tb->vec[i].info & TBL_DEF_HERE)
+			continue;
+		addr = lookup ? lookup(arg, tb->vec[i].name) : NULL;
+		if (addr == NULL) {
+			free(pos);
+			die("%s: %s\n", tb->vec[i].name, msg_no_extern);
+		}
+		pos[i] = code->len;
+		x86_jmp_abs(code, (unsigned long)addr);
+	}
+	for (i = 0; i < st->jobs_len; ++i) {
+		struct emitter *e = &st->jobs[i].em;
+		long base = pos[st->jobs[i].f->gid];
+		for (k = 0; k < e->rel_len; ++k) {
+			long off = base + e->rel[k].off;
+			x86_patch32(code, off, pos[e->rel[k].gid] - off - 4);
+		}
+	}
+	free(pos);
+}
+
+static void syms_form(struct ilc_jit *j, struct state *st)
+{
+	struct gn_sym_tbl *tb = &st->global_tbl;
+	long off = 0;
+	int i;
+
+	j->syms = smalloc((st->jobs_len + 1) * sizeof(struct jit_sym));
+	for (i = 0; i < st->jobs_len; ++i) {
+		struct job *jb = st->jobs + i;
+		struct jit_sym *s = j->syms + j->syms_len++;
+		s->name = sstrdup(tb->vec[jb->f->gid].name);
+		s->off = off;
+		s->size = jb->em.out.len;
+		s->global = (tb->vec[jb->f->gid].info & TBL_GLOBAL) != 0;
+		off += s->size;
+	}
+}
+
+/* Code is never writable and executable at the same time */
+static void code_map(struct ilc_jit *j, struct obuf *code)
+{
+	void *tmp;
+
+	if (code->len == 0)
+		return;
+	tmp = mmap(NULL, code->len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (tmp == MAP_FAILED)
+		die("%s\n", strerror(errno));
+	j->code = tmp;
+	j->len = code->len;
+	memcpy(j->code, code->buf, code->len);
+	if (mprotect(j->code, j->len, PROT_READ | PROT_EXEC) == -1)
+		die("%s\n", strerror(errno));
+}
+
+/*
+ * Lines "<start> <size> <name>" in hex, perf symbolizes JIT code by them.
+ * If the write fails, the file and the buffer are closed before the error
+ * goes on.
+ */
+static void perf_map_write(struct ilc_jit *j)
+{
+	char filename[32];
+	struct obuf b;
+	jmp_buf env;
+	jmp_buf *prev = die_recover;
+	int fd, i;
+
+	if (j->syms_len == 0)
+		return;
+	snprintf(filename, sizeof(filename), perf_map_fmt, (int)getpid());
+	fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd == -1) {
+		warn("%s: %s\n", filename, strerror(errno));
+		return;
+	}
+	obuf_init(&b);
+	for (i = 0; i < j->syms_len; ++i) {
+		obuf_printf(&b, "%lx %lx %s\n",
+				(unsigned long)(j->code + j->syms[i].off),
+				j->syms[i].size, j->syms[i].name);
+	}
+	die_recover = &env;
+	if (setjmp(env)) {
+		die_recover = prev;
+		obuf_free(&b);
+		close(fd);
+		fail();
+	}
+	obuf_flush(&b, fd, filename);
+	die_recover = prev;
+	obuf_free(&b);
+	close(fd);
+}
+
+/* Only global functions are visible */
+void *ilc_jit_sym(struct ilc_jit *j, const char *name)
+{
+	int i;
+	for (i = 0; i < j->syms_len; ++i) {
+		if (j->syms[i].global && strcmp(j->syms[i].name, name) == 0)
+			return j->code + j->syms[i].off;
+	}
+	return NULL;
+}
+
+void ilc_jit_free(struct ilc_jit *j)
+{
+	int i;
+	if (j->code)
+		munmap(j->code, j->len);
+	for (i = 0; i < j->syms_len; ++i)
+		free(j->syms[i].name);
+	free(j->syms);
+	free(j);
+}
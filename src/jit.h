@@ -0,0 +1,23 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "ctx.h"
+
+/*
+ * Compilation of IL to executable memory of the calling process. Code
+ * follows the same calling convention as ilc output, so functions are
+ * called through pointers of type long (*)(long, ...). Diagnostics and
+ * debug output are the ones of context c.
+ */
+
+/* Address of extern function name or NULL if there is no such function */
+typedef void *(*ilc_lookup)(void *arg, const char *name);
+
+struct ilc_jit;
+
+struct ilc_jit *ilc_jit_compile(struct ctx *c, const char *src, long len,
+		ilc_lookup lookup, void *arg);
+void *ilc_jit_sym(struct ilc_jit *j, const char *name);
+void ilc_jit_free(struct ilc_jit *j);
+
+#endif
@@ -1,48 +1,52 @@
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "global.h"
 #include "lparse.h"
+#include "input.h"
 
-static const char *msg_lxm_len_limit =
-	"lexem at %d, %d: lexems can't be longer than %d symbols";
 static const char *msg_var_zero =
 	"variable name can't be empty string";
 static const char *msg_fname_zero =
 	"function name can't be empty string";
 static const char *msg_inv_sym = "invalid symbol";
+static const char *msg_underflow = "underflow detected";
+static const char *msg_overflow = "overflow detected";
+static const char *msg_no_digits = "number has no digits";
 
-static const char *str_global_spec = "global";
-static const char *str_func_decl = "func";
-static const char *str_int_spec = "i";
-static const char *str_cmd_call = "call";
-static const char *str_cmd_add = "add";
-static const char *str_cmd_sub = "sub";
-static const char *str_cmd_mul = "mul";
-static const char *str_cmd_umul = "umul";
-static const char *str_cmd_div = "div";
-static const char *str_cmd_udiv = "udiv";
-static const char *str_cmd_rem = "rem";
-static const char *str_cmd_urem = "urem";
-static const char *str_cmd_copy = "copy";
-static const char *str_cmd_ret = "ret";
-
-struct lexem {
-	struct lexem_block lb;
-	struct lexem *next;
+struct position {
+	struct coord cor;
+	int last_was_nl;
 };
 
-struct lexem_list {
-	int last_is_nl;
-	struct lexem *first;
-	struct lexem *last;
+struct scanner {
+	char *base;
+	char *p;
+	char *end;
+	struct position pos;
 };
 
-struct position {
-	struct coord cor;
-	int last_was_nl;
+/*
+ * Lexems are kept in one growable vector. Lists returned by
+ * ll_extract_upto_lt are slices of it: they share vec with their
+ * parent and have cap == 0, so they never reallocate or free it.
+ *
+ * Names are not copied out of the source: lexems refer to them by
+ * offset in src, so the list that owns vec keeps the input open.
+ * Streamed list keeps its scanner to go on, see ll_scan_upto_lt.
+ */
+struct lexem_list {
+	int last_is_nl;
+	struct lexem_block *vec;
+	int pos;	/* next lexem ll_get will return */
+	int len;
+	int cap;
+	char *src;
+	struct input in;
+	struct scanner sc;
 };
 
 static inline void pos_next(struct position *p, char c)
@@ -58,230 +62,435 @@ static inline void pos_next(struct position *p, char c)
 		p->last_was_nl = 1;
 }
 
-static inline int is_separ(char c)
+/* Classes of symbols, that may continue a lexem of some kind */
+enum {
+	types_max_len = 256
+};
+
+enum {
+	cc_separ = 1,
+	cc_digit = 2,
+	cc_word = 4,
+	cc_gname = 8,
+	cc_var = 16
+};
+
+static const unsigned char char_class[256] = {
+	[' ']			= cc_separ,
+	['\t']			= cc_separ,
+	['0' ... '9']	= cc_digit | cc_word | cc_gname | cc_var,
+	['a' ... 'z']	= cc_word | cc_gname | cc_var,
+	['A' ... 'Z']	= cc_word | cc_gname | cc_var,
+	['_']			= cc_gname | cc_var,
+	['.']			= cc_var
+};
+
+/* What the first symbol of a lexem says about the lexem */
+enum {
+	ls_invalid,
+	ls_separ,
+	ls_single,
+	ls_word,
+	ls_variable,
+	ls_number,
+	ls_gname
+};
+
+static const unsigned char lexem_start[256] = {
+	[' ']			= ls_separ,
+	['\t']			= ls_separ,
+	['\n']			= ls_single,
+	['(']			= ls_single,
+	[')']			= ls_single,
+	[',']			= ls_single,
+	['{']			= ls_single,
+	['}']			= ls_single,
+	['=']			= ls_single,
+	['a' ... 'z']	= ls_word,
+	['A' ... 'Z']	= ls_word,
+	['%']			= ls_variable,
+	['0' ... '9']	= ls_number,
+	['-']			= ls_number,
+	['$']			= ls_gname
+};
+
+static const unsigned char single_lexem[256] = {
+	['\n']	= lx_new_line,
+	['(']	= lx_parenleft,
+	[')']	= lx_parenright,
+	[',']	= lx_coma,
+	['{']	= lx_open_brace,
+	['}']	= lx_close_brace,
+	['=']	= lx_equal_sign
+};
+
+/*
+ * Perfect hash of the keywords: sum of the first and the last symbols is
+ * unique for every keyword modulo 32. If you add a keyword, check that it
+ * still is (gcc -Woverride-init will tell).
+ */
+#define KW_HASH(first, last) (((unsigned char)(first) + \
+			(unsigned char)(last)) & 31)
+#define KW(str, first, last, type) [KW_HASH(first, last)] = \
+	{ str, sizeof(str) - 1, type }
+
+struct keyword {
+	char *str;
+	int len;
+	enum lexem_type lt;
+};
+
+static const struct keyword keywords[32] = {
+	KW("func", 'f', 'c', lx_func_decl),
+	KW("i", 'i', 'i', lx_int_spec),
+	KW("call", 'c', 'l', lx_cmd_call),
+	KW("add", 'a', 'd', lx_cmd_add),
+	KW("sub", 's', 'b', lx_cmd_sub),
+	KW("mul", 'm', 'l', lx_cmd_mul),
+	KW("umul", 'u', 'l', lx_cmd_umul),
+	KW("div", 'd', 'v', lx_cmd_div),
+	KW("udiv", 'u', 'v', lx_cmd_udiv),
+	KW("rem", 'r', 'm', lx_cmd_rem),
+	KW("urem", 'u', 'm', lx_cmd_urem),
+	KW("copy", 'c', 'y', lx_cmd_copy),
+	KW("ret", 'r', 't', lx_cmd_ret),
+	KW("global", 'g', 'l', lx_global_spec)
+};
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+
+/*
+ * Bit i of the result is set if symbol i of the block belongs to the
+ * class. x is in [lo, hi] if saturated (x - lo) - (hi - lo) is zero.
+ */
+#define CLASS_MASK(name, vtype, pfx, si) \
+static inline unsigned int name(char *p, int cls) \
+{ \
+	vtype v = pfx ## _loadu_ ## si((vtype *)p); \
+	vtype zero = pfx ## _setzero_ ## si(); \
+	vtype m; \
+	if (cls == cc_separ) \
+		return pfx ## _movemask_epi8(pfx ## _or_ ## si( \
+			pfx ## _cmpeq_epi8(v, pfx ## _set1_epi8(' ')), \
+			pfx ## _cmpeq_epi8(v, pfx ## _set1_epi8('\t')))); \
+	m = pfx ## _cmpeq_epi8(pfx ## _subs_epu8( \
+			pfx ## _sub_epi8(v, pfx ## _set1_epi8('0')), \
+			pfx ## _set1_epi8('9' - '0')), zero); \
+	if (cls & (cc_word | cc_gname | cc_var)) { \
+		vtype l = pfx ## _or_ ## si(v, pfx ## _set1_epi8(0x20)); \
+		m = pfx ## _or_ ## si(m, pfx ## _cmpeq_epi8(pfx ## _subs_epu8( \
+				pfx ## _sub_epi8(l, pfx ## _set1_epi8('a')), \
+				pfx ## _set1_epi8('z' - 'a')), zero)); \
+	} \
+	if (cls & (cc_gname | cc_var)) \
+		m = pfx ## _or_ ## si(m, \
+				pfx ## _cmpeq_epi8(v, pfx ## _set1_epi8('_'))); \
+	if (cls & cc_var) \
+		m = pfx ## _or_ ## si(m, \
+				pfx ## _cmpeq_epi8(v, pfx ## _set1_epi8('.'))); \
+	return pfx ## _movemask_epi8(m); \
+}
+
+#ifdef __AVX2__
+CLASS_MASK(class_mask32, __m256i, _mm256, si256)
+#endif
+CLASS_MASK(class_mask16, __m128i, _mm, si128)
+#endif
+
+/* Returns pointer to the first symbol after p, that is not of class cls */
+static inline char *class_run_end(char *p, char *end, int cls)
 {
-	if (c == ' ' || c == '\t')
-		return 1;
-	return 0;
+#ifdef __AVX2__
+	for (; end - p >= 32; p += 32) {
+		unsigned int m = ~class_mask32(p, cls);
+		if (m)
+			return p + __builtin_ctz(m);
+	}
+#endif
+#if defined(__SSE2__) || defined(__AVX2__)
+	for (; end - p >= 16; p += 16) {
+		unsigned int m = ~class_mask16(p, cls) & 0xffff;
+		if (m)
+			return p + __builtin_ctz(m);
+	}
+#endif
+	for (; p < end && (char_class[(unsigned char)*p] & cls); ++p);
+	return p;
+}
+
+static struct lexem_list *lexem_scan(struct lexem_list *ll);
+static void scanner_init(struct lexem_list *ll);
+
+struct lexem_list *lexem_parse(char *filename)
+{
+	struct input in;
+	struct lexem_list *ll;
+	input_open(&in, filename);
+	ll = ll_init();
+	ll->in = in;
+	return lexem_scan(ll);
 }
 
-static inline int is_alpha(char c)
+struct lexem_list *lexem_parse_string(const char *s, long len)
 {
-	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
-		return 1;
-	return 0;
+	struct lexem_list *ll = ll_init();
+	input_copy(&ll->in, s, len);
+	return lexem_scan(ll);
 }
 
-static inline int is_number(char c)
+/* Nothing is scanned yet, see ll_scan_upto_lt */
+struct lexem_list *lexem_stream(char *filename)
 {
-	if (c >= '0' && c <= '9')
-		return 1;
-	return 0;
+	struct input in;
+	struct lexem_list *ll;
+	input_open(&in, filename);
+	ll = ll_init();
+	ll->in = in;
+	scanner_init(ll);
+	return ll;
 }
 
-static void eat_lexem(FILE *ifile, char *buffer, struct position *pos,
-	   	struct lexem_list *ll);
+static void eat_lexem(struct scanner *sc, char c, struct lexem_list *ll);
 static void debug_global_lexem_parse(struct lexem_list *l);
 
-struct lexem_list *lexem_parse(char *filename)
+static void scanner_init(struct lexem_list *ll)
 {
-	struct lexem_list *ll = ll_init();
-	FILE *ifile = fopen(filename, "r");
-	struct position pos = { { 1, 0 }, 0 };
-	int c;
-
-	if (ifile == NULL)
-		die("%s: %s\n", filename, strerror(errno));
-	while((c = fgetc(ifile)) != EOF) {
-		char buffer[max_lexem_len + 1];
-		pos_next(&pos, c);
-		if (is_separ(c))
-			continue;
-		buffer[0] = c;
-		eat_lexem(ifile, buffer, &pos, ll);
+	struct scanner *sc = &ll->sc;
+	ll->src = sc->base = sc->p = ll->in.data;
+	sc->end = ll->in.data + ll->in.len;
+	sc->pos.cor.row = 1;
+	sc->pos.cor.col = 0;
+	sc->pos.last_was_nl = 0;
+}
+
+static void scan_all(struct lexem_list *ll);
+
+/* List is not known to the caller yet, so it is freed on error here */
+static struct lexem_list *lexem_scan(struct lexem_list *ll)
+{
+	jmp_buf env;
+	jmp_buf *prev = die_recover;
+
+	die_recover = &env;
+	if (setjmp(env)) {
+		die_recover = prev;
+		ll_free(ll);
+		fail();
 	}
-	if (fclose(ifile) == -1)
-		die("%s: %s\n", filename, strerror(errno));
+	scan_all(ll);
+	die_recover = prev;
 	debug_global_lexem_parse(ll);
 	return ll;
 }
 
-static void eat_name(FILE *ifile, char *buffer, union lexem_data *dt,
-		struct coord *start, struct position *pos);
-static void eat_variable(FILE *ifile, char *buffer, union lexem_data *dt,
-		struct coord *start, struct position *pos);
-static void eat_number(FILE *ifile, char *buffer, union lexem_data *dt,
-		struct coord *start, struct position *pos);
-static void eat_func_name(FILE *ifile, char *buffer, union lexem_data *dt,
-		struct coord *start, struct position *pos);
+static void scan_all(struct lexem_list *ll)
+{
+	struct scanner *sc = &ll->sc;
+
+	scanner_init(ll);
+	while (sc->p < sc->end) {
+		char c = *sc->p++;
+		pos_next(&sc->pos, c);
+		eat_lexem(sc, c, ll);
+	}
+}
+
+/*
+ * Lexems already taken by ll_get are dropped, then source is scanned up
+ * to the next lexem of type lt. Returns 0, if the source ended before
+ * it. Source is given back, once all its lexems are taken.
+ */
+int ll_scan_upto_lt(struct lexem_list *ll, enum lexem_type lt)
+{
+	struct scanner *sc = &ll->sc;
+	int found = 0;
+	int len;
+
+	if (ll->pos == ll->len)
+		input_drop(&ll->in, sc->p - sc->base);
+	memmove(ll->vec, ll->vec + ll->pos,
+			(ll->len - ll->pos) * sizeof(struct lexem_block));
+	ll->len -= ll->pos;
+	ll->pos = 0;
+	while (!found && sc->p < sc->end) {
+		char c = *sc->p++;
+		len = ll->len;
+		pos_next(&sc->pos, c);
+		eat_lexem(sc, c, ll);
+		found = ll->len > len && ll->vec[len].lt == lt;
+	}
+	debug_global_lexem_parse(ll);
+	return found;
+}
+
+/*
+ * Eats the rest of a lexem, whose first symbol is already eaten. Lexems
+ * never contain newlines, so the column can be advanced at once.
+ */
+static inline char *eat_run(struct scanner *sc, int cls)
+{
+	char *start = sc->p;
+	sc->p = class_run_end(sc->p, sc->end, cls);
+	sc->pos.cor.col += sc->p - start;
+	return start;
+}
 
-static void lexem_clarify(char *buffer, enum lexem_type *lt,
-		struct coord *pos);
+static long long lexem_number(char *s, int len, struct coord *pos);
+static enum lexem_type lexem_clarify(char *s, int len, struct coord *pos);
 
-static void eat_lexem(FILE *ifile, char *buffer, struct position *pos,
-	   	struct lexem_list *ll)
+static void eat_lexem(struct scanner *sc, char c, struct lexem_list *ll)
 {
 	struct lexem_block b;
-	b.crd = pos->cor;
-	if (buffer[0] == '\n') {
-		b.lt = lx_new_line;
-	} else if(is_alpha(buffer[0])) {
-		b.lt = lx_word;
-		eat_name(ifile, buffer, &b.dt, &b.crd, pos);
-	} else if (buffer[0] == '(') {
-		b.lt = lx_parenleft;
-	} else if (buffer[0] == ')') {
-		b.lt = lx_parenright;
-	} else if (buffer[0] == ',') {
-		b.lt = lx_coma;
-	} else if (buffer[0] == '%') {
+	char *start;
+	b.crd = sc->pos.cor;
+	switch (lexem_start[(unsigned char)c]) {
+	case ls_separ:
+		eat_run(sc, cc_separ);
+		return;
+	case ls_single:
+		b.lt = single_lexem[(unsigned char)c];
+		break;
+	case ls_word:
+		start = eat_run(sc, cc_word) - 1;
+		b.lt = lexem_clarify(start, sc->p - start, &b.crd);
+		break;
+	case ls_variable:
 		b.lt = lx_variable;
-		eat_variable(ifile, buffer, &b.dt, &b.crd, pos);
-	} else if (buffer[0] == '{') {
-		b.lt = lx_open_brace;
-	} else if (buffer[0] == '}') {
-		b.lt = lx_close_brace;
-	} else if (is_number(buffer[0]) || buffer[0] == '-') {
+		start = eat_run(sc, cc_var);
+		if (sc->p == start)
+			die("%d,%d: %s\n", b.crd.row, b.crd.col, msg_var_zero);
+		b.dt.view.off = start - sc->base;
+		b.dt.view.len = sc->p - start;
+		break;
+	case ls_number:
 		b.lt = lx_number;
-		eat_number(ifile, buffer, &b.dt, &b.crd, pos);
-	} else if (buffer[0] == '=') {
-		b.lt = lx_equal_sign;
-	} else if (buffer[0] == '$') {
+		start = eat_run(sc, cc_digit) - 1;
+		b.dt.value = lexem_number(start, sc->p - start, &b.crd);
+		break;
+	case ls_gname:
 		b.lt = lx_global_name;
-		eat_func_name(ifile, buffer, &b.dt, &b.crd, pos);
-	} else {
-		die("%d,%d: %s\n", pos->cor.row, pos->cor.col, msg_inv_sym);
+		start = eat_run(sc, cc_gname);
+		if (sc->p == start)
+			die("%d,%d: %s\n", b.crd.row, b.crd.col, msg_fname_zero);
+		b.dt.view.off = start - sc->base;
+		b.dt.view.len = sc->p - start;
+		break;
+	default:
+		die("%d,%d: %s\n", sc->pos.cor.row, sc->pos.cor.col, msg_inv_sym);
 	}
-	if (b.lt == lx_word)
-		lexem_clarify(buffer, &b.lt, &b.crd);
 	ll_add(ll, &b);
 }
 
-#define EAT_TMP(func_name, buf_pos, predicate, save_buf, \
-		die_if_none, die_msg) \
-static void func_name(FILE *ifile, char *buffer, union lexem_data *dt, \
-		struct coord *start, struct position *pos) \
-{ \
-	int bufpos = buf_pos; \
-	for (;; ++bufpos) { \
-		int c = fgetc(ifile); \
-		if (!(predicate)) { \
-			ungetc(c, ifile); \
-			break; \
-		} \
-		if (bufpos + 1 > max_lexem_len) \
-			die(msg_lxm_len_limit, start->row, start->col, max_lexem_len); \
-		pos_next(pos, c); \
-		buffer[bufpos] = c; \
-	} \
-	if (die_if_none && bufpos == 0) \
-		die("%d,%d: %s\n", start->row, start->col, die_msg); \
-	buffer[bufpos] = 0; \
-	if (!save_buf) \
-		return; \
-	dt->str_value = sstrdup(buffer); \
+static long long lexem_number(char *s, int len, struct coord *pos)
+{
+	long long res = 0;
+	int neg = s[0] == '-';
+	int i;
+	if (len == neg)
+		die("%d,%d:\'%.*s\': %s\n", pos->row, pos->col, len, s,
+				msg_no_digits);
+	for (i = neg; i < len; ++i) {
+		int d = s[i] - '0';
+		if (!neg && res > (LLONG_MAX - d) / 10)
+			die("%d,%d:\'%.*s\': %s\n", pos->row, pos->col, len, s,
+					msg_overflow);
+		if (neg && res < (LLONG_MIN + d) / 10)
+			die("%d,%d:\'%.*s\': %s\n", pos->row, pos->col, len, s,
+					msg_underflow);
+		res = neg ? res * 10 - d : res * 10 + d;
+	}
+	return res;
 }
 
-EAT_TMP(eat_name, 1, is_alpha(c) || is_number(c), 0, 0, NULL)
-EAT_TMP(eat_variable, 0, is_alpha(c) || is_number(c) || \
-		c == '_' || c == '.', 1, 1, msg_var_zero)
-EAT_TMP(eat_number, 1, is_number(c), 1, 0, NULL)
-EAT_TMP(eat_func_name, 0, is_alpha(c) || is_number(c) || c == '_',
-		1, 1, msg_fname_zero)
-
-static void lexem_clarify(char *buffer, enum lexem_type *lt,
-		struct coord *pos)
+static enum lexem_type lexem_clarify(char *s, int len, struct coord *pos)
 {
-	if (strcmp(buffer, str_func_decl) == 0)
-		*lt = lx_func_decl;
-	else if(strcmp(buffer, str_int_spec) == 0)
-		*lt = lx_int_spec;
-	else if(strcmp(buffer, str_cmd_call) == 0)
-		*lt = lx_cmd_call;
-	else if(strcmp(buffer, str_cmd_add) == 0)
-		*lt = lx_cmd_add;
-	else if (strcmp(buffer, str_cmd_sub) == 0)
-		*lt = lx_cmd_sub;
-	else if (strcmp(buffer, str_cmd_mul) == 0)
-		*lt = lx_cmd_mul;
-	else if (strcmp(buffer, str_cmd_umul) == 0)
-		*lt = lx_cmd_umul;
-	else if (strcmp(buffer, str_cmd_div) == 0)
-		*lt = lx_cmd_div;
-	else if (strcmp(buffer, str_cmd_udiv) == 0)
-		*lt = lx_cmd_udiv;
-	else if (strcmp(buffer, str_cmd_rem) == 0)
-		*lt = lx_cmd_rem;
-	else if (strcmp(buffer, str_cmd_urem) == 0)
-		*lt = lx_cmd_urem;
-	else if(strcmp(buffer, str_cmd_copy) == 0)
-		*lt = lx_cmd_copy;
-	else if(strcmp(buffer, str_cmd_ret) == 0)
-		*lt = lx_cmd_ret;
-	else if(strcmp(buffer, str_global_spec) == 0)
-		*lt = lx_global_spec;
-	else
+	const struct keyword *kw = keywords + KW_HASH(s[0], s[len - 1]);
+	if (kw->len != len || memcmp(kw->str, s, len) != 0)
 		die("[%d,%d]: unknown lexem\n", pos->row, pos->col);
+	return kw->lt;
 }
 
 static void debug_global_lexem_parse(struct lexem_list *l)
 {
-	if (dbg_global_lexem_parse == 0)
+	if (DBG(global_lexem_parse) == 0)
 		return;
-	eprintf("----Global lexem parse----\n");
-	ll_print(stderr, l);
-	eprintf("\n");
+	dbg_printf("----Global lexem parse----\n");
+	ll_print(dbg_stream(), l);
+	dbg_printf("\n");
 }
 
 struct lexem_list *ll_init()
 {
 	struct lexem_list *tmp = smalloc(sizeof(struct lexem_list));
-	tmp->first = tmp->last = NULL;
+	tmp->cap = ll_init_cap;
+	tmp->vec = smalloc(tmp->cap * sizeof(struct lexem_block));
+	tmp->pos = tmp->len = 0;
 	tmp->last_is_nl = 0;
+	tmp->src = NULL;
+	tmp->in.data = NULL;
 	return tmp;
 }
 
+void ll_free(struct lexem_list *ll)
+{
+	if (ll->cap) {
+		free(ll->vec);
+		if (ll->in.data)
+			input_close(&ll->in);
+	}
+	free(ll);
+}
+
 void ll_add(struct lexem_list *ll, struct lexem_block *b)
 {
 	if (b->lt == lx_new_line && ll->last_is_nl)
 		return;
-	if (ll->first == NULL)
-		ll->first = ll->last = smalloc(sizeof(struct lexem));
-	else
-		ll->last = ll->last->next = smalloc(sizeof(struct lexem));
-	ll->last->lb.lt = b->lt;
-	ll->last->lb.crd = b->crd;
-	ll->last->lb.dt = b->dt;
-	ll->last->next = NULL;
+	if (ll->len == ll->cap) {
+		ll->cap *= 2;
+		ll->vec = realloc(ll->vec, ll->cap * sizeof(struct lexem_block));
+		if (ll->vec == NULL)
+			die("%s\n", strerror(ENOMEM));
+	}
+	ll->vec[ll->len++] = *b;
 	ll->last_is_nl = b->lt == lx_new_line;
 }
 
 int ll_get(struct lexem_list *ll, struct lexem_block *b)
 {
-	struct lexem *tmp;
-	if (ll->first == NULL)
+	if (ll->pos == ll->len)
 		return 0;
-	if (ll->first == ll->last)
-		ll->last = NULL;
-	tmp = ll->first;
-	ll->first = ll->first->next;
-	b->lt = tmp->lb.lt;
-	b->crd = tmp->lb.crd;
-	b->dt = tmp->lb.dt;
-	free(tmp);
+	*b = ll->vec[ll->pos++];
 	return 1;
 }
 
-static void lexem_types_print(FILE *f, enum lexem_type *vec, int vec_len);
+struct lexem_block *ll_begin(struct lexem_list *ll)
+{
+	return ll->vec + ll->pos;
+}
 
+struct lexem_block *ll_end(struct lexem_list *ll)
+{
+	return ll->vec + ll->len;
+}
+
+char *ll_source(struct lexem_list *ll)
+{
+	return ll->src;
+}
+
+static void lexem_types_print(char *buf, int size, enum lexem_type *vec,
+		int vec_len);
+
+/* Syntax errors are diagnostics as any other, see die */
 int lexem_clever_get(struct lexem_list *l, struct lexem_block *b,
 		enum lexem_type *ltvec, int ltvec_len)
 {
+	char expected[types_max_len];
 	int i;
 	if (ll_get(l, b) == 0) {
-		eprintf("expected ");
-		lexem_types_print(stderr, ltvec, ltvec_len);
-		eprintf(", not eof\n");
+		lexem_types_print(expected, sizeof(expected), ltvec, ltvec_len);
+		die("expected %s, not eof\n", expected);
 	}
 	for (i = 0; i < ltvec_len; ++i) {
 		if (ltvec[i] >= 1000000) {
@@ -291,43 +500,45 @@ int lexem_clever_get(struct lexem_list *l, struct lexem_block *b,
 			return i;
 		}
 	}
-	eprintf("%d,%d: expected ", b->crd.row, b->crd.col);
-	lexem_types_print(stderr, ltvec, ltvec_len);
-	eprintf(", not ");
-	eprintf("%s\n", LNAME(b->lt, 0, NULL));
-	exit(1);
+	lexem_types_print(expected, sizeof(expected), ltvec, ltvec_len);
+	die("%d,%d: expected %s, not %s\n", b->crd.row, b->crd.col, expected,
+			LNAME(b->lt));
 	return -1;
 }
 
-static void lexem_types_print(FILE *f, enum lexem_type *vec, int vec_len)
+/* Names are joined with "or", the list is cut to fit size */
+static void lexem_types_print(char *buf, int size, enum lexem_type *vec,
+		int vec_len)
 {
-	int i;
-	char *buf = alloca(lexem_alloca_size);
-	for (i = 0; i < vec_len ; ++i) {
-		fprintf(f, "%s", lexem_name(buf, vec[i] > 1000000 ?
-				vec[i] - 1000000 : vec[i], 0, NULL));
-		if (i < vec_len - 1)
-			fprintf(f, " or ");
+	int i, len = 0;
+	buf[0] = 0;
+	for (i = 0; i < vec_len && len < size; ++i) {
+		len += snprintf(buf + len, size - len, "%s%s",
+				lexem_name(vec[i] > 1000000 ? vec[i] - 1000000 : vec[i]),
+				i < vec_len - 1 ? " or " : "");
 	}
 }
 
 struct lexem_list *ll_extract_upto_lt(struct lexem_list *l,
 		enum lexem_type lt)
 {
-	struct lexem_list *newl = ll_init();
-	struct lexem **tmp = &l->first;
+	struct lexem_list *newl;
+	int i;
 
-	for (; *tmp && ((*tmp)->lb.lt != lt); tmp = &(*tmp)->next);
+	for (i = l->pos; i < l->len && l->vec[i].lt != lt; ++i);
 
-	if (*tmp == NULL)
+	if (i == l->len)
 		return NULL;
 
-	newl->first = l->first;
-	newl->last = *tmp;
-	l->first = newl->last->next;
-	newl->last->next = NULL;
-	if (l->first == NULL)
-		l->last = NULL;
+	newl = smalloc(sizeof(struct lexem_list));
+	newl->last_is_nl = 0;
+	newl->vec = l->vec;
+	newl->src = l->src;
+	newl->in.data = NULL;
+	newl->pos = l->pos;
+	newl->len = i + 1;
+	newl->cap = 0;
+	l->pos = i + 1;
 	return newl;
 }
 
@@ -340,6 +551,7 @@ char *lexem_names[] = {
 	[lx_parenright]		=	"parenright",
 	[lx_coma]			=	"coma",
 	[lx_variable]		=	"variable",		/**/
+	[lx_var_interned]	=	"interned variable",	/**/
 	[lx_var_remapped]	=	"var",			/**/
 	[lx_open_brace]		=	"openbrace",
 	[lx_close_brace]	=	"closebrace",
@@ -364,24 +576,34 @@ char *lexem_names[] = {
 	[lx_cmd_ret]		=	P"ret"
 };
 
-char *lexem_name(char *buf, enum lexem_type lt, int v, union lexem_data *dt)
+char *lexem_name(enum lexem_type lt)
 {
-	sprintf(buf, lexem_names[lt]);
-
-	if (lt < lx_new_line && v) {
-		if (lt >= lx_var_remapped)
-			sprintf(buf + strlen(lexem_names[lt]), "[%d]", dt->number);
-		else
-			sprintf(buf + strlen(lexem_names[lt]), "[%s]", dt->str_value);
-	}
-	return buf;
+	return lexem_names[lt];
 }
 
 void ll_print(FILE *f, struct lexem_list *ll)
 {
-	struct lexem *tmp = ll->first;
-	for (; tmp; tmp = tmp->next) {
-		fprintf(f, "%02d,%02d: %s\n", tmp->lb.crd.row, tmp->lb.crd.col,
-				LNAME(tmp->lb.lt, 1, &tmp->lb.dt));
+	struct lexem_block *tmp = ll_begin(ll);
+	for (; tmp != ll_end(ll); ++tmp) {
+		fprintf(f, "%02d,%02d: %s", tmp->crd.row, tmp->crd.col,
+				LNAME(tmp->lt));
+		switch (tmp->lt) {
+		case lx_variable:
+		case lx_global_name:
+			fprintf(f, "[%.*s]", tmp->dt.view.len,
+					ll->src + tmp->dt.view.off);
+			break;
+		case lx_number:
+			fprintf(f, "[%lld]", tmp->dt.value);
+			break;
+		case lx_var_interned:
+		case lx_var_remapped:
+		case lx_gn_rmp:
+			fprintf(f, "[%d]", tmp->dt.number);
+			break;
+		default:
+			break;
+		}
+		fprintf(f, "\n");
 	}
 }
@@ -2,13 +2,13 @@
 #define LPARSE_H
 
 #include <stdio.h>
-#include <alloca.h>
 
 enum lexem_type {
 	lx_word,
 	lx_number,
 	lx_global_name,
 	lx_variable,
+	lx_var_interned,
 	lx_var_remapped,
 	lx_gn_rmp,
 
@@ -39,8 +39,7 @@ enum lexem_type {
 };
 
 enum {
-	max_lexem_len = 32,
-	lexem_alloca_size = 50 + max_lexem_len
+	ll_init_cap = 1024
 };
 
 struct coord {
@@ -48,9 +47,16 @@ struct coord {
 	int col;
 };
 
+/* Lexem text inside the source buffer, see ll_source */
+struct lexem_view {
+	long off;
+	int len;
+};
+
 union lexem_data {
-	char *str_value;
-	int number;
+	struct lexem_view view;	/* lx_variable, lx_global_name */
+	long long value;		/* lx_number */
+	int number;				/* lx_var_interned, lx_var_remapped, lx_gn_rmp */
 };
 
 struct lexem_block {
@@ -62,19 +68,24 @@ struct lexem_block {
 struct lexem_list;
 
 struct lexem_list *lexem_parse(char *filename);
+struct lexem_list *lexem_parse_string(const char *s, long len);
+struct lexem_list *lexem_stream(char *filename);
+int ll_scan_upto_lt(struct lexem_list *ll, enum lexem_type lt);
 
 struct lexem_list *ll_init();
+void ll_free(struct lexem_list *ll);
 void ll_add(struct lexem_list *ll, struct lexem_block *b);
 int ll_get(struct lexem_list *ll, struct lexem_block *b);
+struct lexem_block *ll_begin(struct lexem_list *ll);
+struct lexem_block *ll_end(struct lexem_list *ll);
+char *ll_source(struct lexem_list *ll);
 int lexem_clever_get(struct lexem_list *l, struct lexem_block *b,
 		enum lexem_type *ltvec, int ltvec_len);
 struct lexem_list *ll_extract_upto_lt(struct lexem_list *l,
 		enum lexem_type lt);
 void ll_print(FILE *f, struct lexem_list *ll);
-char *lexem_name(char *buf, enum lexem_type lt, int v,
-		union lexem_data *dt);
+char *lexem_name(enum lexem_type lt);
 
-#define LNAME(lt, v, dt) ({ char *buf = alloca(lexem_alloca_size); \
-	lexem_name(buf, lt, v, dt); })
+#define LNAME(lt) lexem_name(lt)
 
 #endif
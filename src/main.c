@@ -1,10 +1,42 @@
+#include "global.h"
 #include "cmdargs.h"
 #include "process.h"
+#include "batch.h"
+#include "cache.h"
 
 int main(int argc, char **argv)
 {
 	struct settings s;
+	struct ctx c;
+	long start = trace_now();
+	int res;
+
 	cmdargs_handle(argc, argv, &s);
-	process(&s);
-	return 0;
+	ctx_init(&c);
+	/* Files of a batch go in parallel, each on a single thread */
+	c.jobs = s.files_len == 1 ? s.jobs : 1;
+	c.format = s.format;
+	c.cache_dir = s.cache_dir;
+	c.cache_size = s.cache_size << 20;
+	c.stream = s.stream;
+	c.callee_saved = s.callee_saved;
+	c.regalloc = s.regalloc;
+	c.time_report = s.time_report;
+	c.trace_file = s.trace_file;
+	c.dbg = s.dbg;
+	if (s.files_len == 1)
+		res = process(&c, s.input_files[0], s.output_files[0]);
+	else
+		res = batch(&c, &s);
+	if (c.cache_dir)
+		cache_trim(&c);
+	if (c.time_report)
+		trace_report(&c, trace_now() - start);
+	if (c.trace_file)
+		trace_write(&c);
+	if (c.free_all_mem) {
+		settings_free(&s);
+		ctx_free(&c);
+	}
+	return res;
 }
@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "global.h"
+#include "obuf.h"
+
+void obuf_init(struct obuf *b)
+{
+	b->len = 0;
+	b->cap = obuf_init_cap;
+	b->buf = smalloc(b->cap);
+}
+
+void obuf_grow(struct obuf *b, long size)
+{
+	while (b->len + size > b->cap)
+		b->cap *= 2;
+	b->buf = realloc(b->buf, b->cap);
+	if (b->buf == NULL)
+		die("%s\n", strerror(ENOMEM));
+}
+
+void obuf_vprintf(struct obuf *b, char *fmt, va_list vl)
+{
+	va_list cp;
+	int len;
+
+	va_copy(cp, vl);
+	len = vsnprintf(b->buf + b->len, b->cap - b->len, fmt, cp);
+	va_end(cp);
+	if (b->len + len >= b->cap) {
+		obuf_reserve(b, len + 1);
+		vsnprintf(b->buf + b->len, b->cap - b->len, fmt, vl);
+	}
+	b->len += len;
+}
+
+void obuf_printf(struct obuf *b, char *fmt, ...)
+{
+	va_list vl;
+
+	va_start(vl, fmt);
+	obuf_vprintf(b, fmt, vl);
+	va_end(vl);
+}
+
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233"
+	"34353637383940414243444546474849505152535455565758596061626364656667"
+	"6869707172737475767778798081828384858687888990919293949596979899";
+
+/* Decimal, two digits per division */
+void obuf_putnum(struct obuf *b, long long n)
+{
+	char tmp[24];
+	char *p = tmp + sizeof(tmp);
+	unsigned long long u = n < 0 ? -(unsigned long long)n : n;
+
+	while (u >= 100) {
+		int d = (u % 100) * 2;
+		u /= 100;
+		*--p = digit_pairs[d + 1];
+		*--p = digit_pairs[d];
+	}
+	if (u >= 10) {
+		*--p = digit_pairs[u * 2 + 1];
+		*--p = digit_pairs[u * 2];
+	} else {
+		*--p = '0' + u;
+	}
+	if (n < 0)
+		*--p = '-';
+	obuf_put(b, p, tmp + sizeof(tmp) - p);
+}
+
+void obuf_flush(struct obuf *b, int fd, char *filename)
+{
+	char *p = b->buf;
+	long left = b->len;
+	while (left > 0) {
+		long res = write(fd, p, left);
+		if (res == -1 && errno == EINTR)
+			continue;
+		if (res == -1)
+			die("%s: %s\n", filename, strerror(errno));
+		p += res;
+		left -= res;
+	}
+	b->len = 0;
+}
+
+void obuf_free(struct obuf *b)
+{
+	free(b->buf);
+	b->buf = NULL;
+	b->len = b->cap = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef OBUF_H
+#define OBUF_H
+
+#include <stdarg.h>
+#include <string.h>
+
+enum {
+	obuf_init_cap = 1 << 12,
+	obuf_chunk = 1 << 20	/* preferred size of a single write */
+};
+
+/* Growable output buffer */
+struct obuf {
+	char *buf;
+	long len;
+	long cap;
+};
+
+void obuf_init(struct obuf *b);
+void obuf_grow(struct obuf *b, long size);
+void obuf_vprintf(struct obuf *b, char *fmt, va_list vl);
+void obuf_printf(struct obuf *b, char *fmt, ...);
+void obuf_putnum(struct obuf *b, long long n);
+void obuf_flush(struct obuf *b, int fd, char *filename);
+void obuf_free(struct obuf *b);
+
+/* Returns place for size more bytes */
+static inline char *obuf_reserve(struct obuf *b, long size)
+{
+	if (b->len + size > b->cap)
+		obuf_grow(b, size);
+	return b->buf + b->len;
+}
+
+static inline void obuf_put(struct obuf *b, const char *s, int len)
+{
+	memcpy(obuf_reserve(b, len), s, len);
+	b->len += len;
+}
+
+#define OBUF_LIT(b, lit) obuf_put((b), (lit), sizeof(lit) - 1)
+
+#endif
@@ -1,73 +1,146 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "global.h"
-#include "cmdargs.h"
 #include "lparse.h"
 #include "process.h"
 #include "remap.h"
 #include "func.h"
 #include "alloc.h"
 #include "emit.h"
-#include "process.h"
+#include "arena.h"
+#include "cmdargs.h"
+#include "elfobj.h"
+#include "cache.h"
 
 static const char *msg_free_gl = "lonely global specifier";
+static const char *msg_sink_failed = "output sink failed";
+static const char *msg_stream_sink =
+	"object can't be streamed to a sink, it is written out of order";
 
-static void fl_add(struct func_list *fl, struct function *f);
+struct worker {
+	struct state *st;
+	struct var_map vm;
+	struct cache_key key;
+	pthread_t thread;
+};
 
-static void act1(struct state *st, struct settings *sts);
+static void act1(struct state *st);
 static void act2(struct state *st);
+static void act_stream(struct state *st);
 
-void process(struct settings *sts)
+/*
+ * Returns 0 on success, diagnostics are in the context. On error
+ * everything, that is already written to the file, is removed and memory
+ * of the failed module is freed. Output goes to the sink of the context,
+ * if it is set, output_file only names it then.
+ */
+int process(struct ctx *c, char *input_file, char *output_file)
 {
 	struct state st;
+	jmp_buf env;
+	jmp_buf *prev = die_recover;
+	struct ctx *prev_ctx = ctx_cur;
+	long start;
+
 	memset(&st, 0, sizeof(struct state));
+	st.ctx = c;
+	st.out = -1;
+	st.bin = c->format == fmt_elf64;
+	st.input_file = input_file;
+	st.output_file = output_file;
+	ctx_cur = c;
+	diag_file = input_file;
+	die_recover = &env;
+	if (setjmp(env)) {
+		if (st.out != -1) {
+			close(st.out);
+			remove(output_file);
+		}
+		module_free(&st);
+		die_recover = prev;
+		ctx_cur = prev_ctx;
+		diag_file = NULL;
+		return 1;
+	}
+
+	if (c->stream) {
+		start = trace_clock(c);
+		act_stream(&st);
+		trace_end(c, ph_stream, start, NULL);
+	} else {
+		start = trace_clock(c);
+		act1(&st);
+		trace_end(c, ph_act1, start, NULL);
+		module_compile(&st, c->jobs);
+		start = trace_clock(c);
+		act2(&st);
+		trace_end(c, ph_act2, start, NULL);
+	}
 
-	act1(&st, sts);
-	act2(&st);
+	die_recover = prev;
+	ctx_cur = prev_ctx;
+	diag_file = NULL;
+	return 0;
 }
 
-static FILE *open_file(char *s);
+static int open_file(char *s);
 static int preprocess_entry(struct state *s);
 
-static void act1(struct state *st, struct settings *sts)
+static void act1(struct state *st)
 {
-	if (dbg_acts_start)
-		eprintf("\n\n------First act begin------\n\n");
+	struct lexem_list *l;
+	long start;
 
-	output_file = open_file(sts->output_file);
-	if (dbg_free_all_mem)
-		free(sts->output_file);
+	if (DBG(acts_start))
+		dbg_printf("\n\n------First act begin------\n\n");
 
-	st->l = remap_gns(lexem_parse(sts->input_file), &st->global_tbl);
+	if (st->ctx->sink == NULL)
+		st->out = open_file(st->output_file);
+	start = trace_clock(st->ctx);
+	l = lexem_parse(st->input_file);
+	trace_end(st->ctx, ph_lexem_parse, start, NULL);
+	module_parse(st, l);
+}
+
+/* Splits the module into jobs, one per function */
+void module_parse(struct state *st, struct lexem_list *l)
+{
+	long start = trace_clock(st->ctx);
+
+	st->l = l;
+	intern_init(&st->names);
+	remap_gns(l, &st->global_tbl, &st->names);
+	trace_end(st->ctx, ph_remap_gns, start, NULL);
 	debug_gn_sym_tbl_pre(&st->global_tbl);
 
+	st->gl_pos.row = -1;
 	while (preprocess_entry(st));
 }
 
-static FILE *open_file(char *s)
+static int open_file(char *s)
 {
-	FILE *tmp = fopen(s, "w");
-	if (tmp == NULL)
+	int tmp = open(s, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (tmp == -1)
 		die("%s: %s\n", s, strerror(errno));
 	return tmp;
 }
 
-static struct function *process_function(int gl_spec, struct lexem_list *l,
-		struct gn_sym_tbl *tbl, struct fcall_list *cl);
+static void job_add(struct state *s, struct lexem_list *l, int gl_spec);
 
 static int preprocess_entry(struct state *s)
 {
-	static struct coord gl_pos = { -1, 0 };
-
 	struct lexem_block b;
-	struct function *f;
 
 	if (ll_get(s->l, &b) == 0) {
-		if (gl_pos.row != -1)
-			die("[%d,%d]:%s\n", gl_pos.row, gl_pos.col, msg_free_gl);
+		if (s->gl_pos.row != -1)
+			die("[%d,%d]:%s\n", s->gl_pos.row, s->gl_pos.col, msg_free_gl);
 		return 0;
 	}
 
@@ -75,13 +148,12 @@ static int preprocess_entry(struct state *s)
 	case lx_new_line:
 		break;
 	case lx_global_spec:
-		gl_pos = b.crd;
+		s->gl_pos = b.crd;
 		break;
 	case lx_func_decl:
-		f = process_function(gl_pos.row != -1, s->l,
-				&s->global_tbl, &s->fcl);
-		fl_add(&s->fl, f);
-		gl_pos.row = -1;
+		job_add(s, ll_extract_upto_lt(s->l, lx_close_brace),
+				s->gl_pos.row != -1);
+		s->gl_pos.row = -1;
 		break;
 	default:
 		die("Not a function\n");
@@ -89,72 +161,527 @@ static int preprocess_entry(struct state *s)
 	return 1;
 }
 
-static struct function *process_function(int gl_spec, struct lexem_list *l,
-		struct gn_sym_tbl *tbl, struct fcall_list *cl)
+static void job_add(struct state *s, struct lexem_list *l, int gl_spec)
+{
+	struct job *tmp;
+	if (s->jobs_len == s->jobs_cap) {
+		s->jobs_cap = s->jobs_cap ? s->jobs_cap * 2 : tbl_init_cap;
+		s->jobs = realloc(s->jobs, s->jobs_cap * sizeof(struct job));
+		if (s->jobs == NULL)
+			die("%s\n", strerror(ENOMEM));
+	}
+	tmp = s->jobs + s->jobs_len++;
+	memset(tmp, 0, sizeof(struct job));
+	tmp->l = l;
+	tmp->gl_spec = gl_spec;
+}
+
+static void *worker_run(void *arg);
+
+static void workers_init(struct state *st, int n);
+static void workers_free(struct state *st);
+
+/*
+ * The calling thread is the first worker. Threads, that are started, are
+ * always joined, so the module is not used by anyone after an error.
+ */
+void module_compile(struct state *st, int jobs)
+{
+	struct worker *w;
+	int i, started, err = 0;
+
+	if (jobs > st->jobs_len)
+		jobs = st->jobs_len > 0 ? st->jobs_len : 1;
+	workers_init(st, jobs);
+	w = st->workers;
+	for (started = 1; started < jobs; ++started) {
+		err = pthread_create(&w[started].thread, NULL, worker_run,
+				w + started);
+		if (err) {
+			__atomic_store_n(&st->failed, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	worker_run(w);
+	for (i = 1; i < started; ++i)
+		pthread_join(w[i].thread, NULL);
+
+	workers_free(st);
+	if (err)
+		die("%s\n", strerror(err));
+	if (st->failed)
+		fail();
+}
+
+static void workers_init(struct state *st, int n)
+{
+	int i;
+
+	st->workers = smalloc(n * sizeof(struct worker));
+	memset(st->workers, 0, n * sizeof(struct worker));
+	st->workers_len = n;
+	for (i = 0; i < n; ++i) {
+		st->workers[i].st = st;
+		var_map_init(&st->workers[i].vm, &st->names);
+	}
+}
+
+static void workers_free(struct state *st)
+{
+	int i;
+
+	for (i = 0; i < st->workers_len; ++i) {
+		var_map_free(&st->workers[i].vm);
+		cache_key_free(&st->workers[i].key);
+	}
+	free(st->workers);
+	st->workers = NULL;
+	st->workers_len = 0;
+}
+
+static void process_function(struct job *j, struct worker *w);
+
+/* Error in a job stops the pool, it is reported after all workers exit */
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	struct state *s = w->st;
+	jmp_buf env;
+	jmp_buf *prev = die_recover;
+	int i;
+
+	ctx_cur = s->ctx;
+	diag_file = s->input_file;
+	die_recover = &env;
+	if (setjmp(env) == 0) {
+		while (!__atomic_load_n(&s->failed, __ATOMIC_RELAXED) &&
+				(i = __atomic_fetch_add(&s->next_job, 1,
+					__ATOMIC_RELAXED)) < s->jobs_len)
+			process_function(s->jobs + i, w);
+	} else {
+		__atomic_store_n(&s->failed, 1, __ATOMIC_RELAXED);
+	}
+	die_recover = prev;
+	return NULL;
+}
+
+static void func_release(struct function *f);
+
+static void function_compile(struct job *j, struct worker *w,
+		struct function *f, struct lexem_list *l);
+
+/* Header is parsed always, the rest only if the cache has no code */
+static void process_function(struct job *j, struct worker *w)
 {
+	struct state *s = w->st;
+	char *cache_dir = s->ctx->cache_dir;
+	struct cache_key *key = &w->key;
 	struct function *f = smalloc(sizeof(struct function));
-	if (dbg_gn_borders)
-		eprintf("----Working on global name----\n\n");
+	struct lexem_list *rnml;
+	long start, end;
+	arena_init(&f->ar);
+	f->stb.vec = NULL;
+	f->cl = NULL;
+	f->alloc_table = NULL;
+	/* Job owns everything from here, so an error frees it all */
+	j->f = f;
+	if (DBG(gn_borders))
+		dbg_printf("----Working on global name----\n\n");
 
-	struct lexem_list *funcl = ll_extract_upto_lt(l, lx_close_brace);
-	struct lexem_list *rnml = remap_vars(funcl, &f->stb);
+	start = trace_clock(s->ctx);
+	rnml = remap_vars(j->l, &f->stb, &s->names, &w->vm);
+	end = trace_clock(s->ctx);
 	debug_var_sym_tbl(&f->stb, rnml);
 
-	func_header_form(rnml, f, gl_spec, tbl);
-	cmd_form(rnml, f, tbl, cl);
+	if (cache_dir)
+		cache_key_form(key, rnml, &s->global_tbl, j->gl_spec, s->bin);
+	func_header_form(rnml, f, j->gl_spec, &s->global_tbl);
+	/* Span is named by the function, so it is known only now */
+	trace_span(s->ctx, ph_remap_vars, start, end, f->name);
+	if (cache_dir && cache_load(cache_dir, key, j, s->bin)) {
+		__atomic_add_fetch(&s->cache_hits, 1, __ATOMIC_RELAXED);
+		ll_free(rnml);
+		j->l = NULL;
+	} else {
+		function_compile(j, w, f, rnml);
+		if (cache_dir) {
+			cache_store(cache_dir, key, j);
+			__atomic_add_fetch(&s->cache_misses, 1, __ATOMIC_RELAXED);
+		}
+	}
+	if (cache_dir)
+		cache_key_free(key);
+
+	if (s->ctx->free_all_mem)
+		func_release(f);
+}
+
+static void function_compile(struct job *j, struct worker *w,
+		struct function *f, struct lexem_list *l)
+{
+	struct state *s = w->st;
+	long start, end;
+
+	start = trace_clock(s->ctx);
+	cmd_form(l, f, &s->global_tbl, &j->fcl);
+	trace_end(s->ctx, ph_cmd_form, start, f->name);
 
+	start = trace_clock(s->ctx);
 	f->alloc_table = allocate(f);
-	free(rnml);
-	return f;
+	trace_end(s->ctx, ph_allocate, start, f->name);
+	ll_free(l);
+	j->l = NULL;
+
+	emitter_init(&j->em, s->bin);
+	start = trace_now();
+	asm_emit(&j->em, f);
+	end = trace_now();
+	__atomic_add_fetch(&s->emit_ns, end - start, __ATOMIC_RELAXED);
+	trace_span(s->ctx, ph_asm_emit, start, end, f->name);
+	__atomic_add_fetch(&s->emit_bytes, j->em.out.len, __ATOMIC_RELAXED);
 }
 
-static void func_free(struct function *f);
+/* Only header of the function is needed after emission */
+static void func_release(struct function *f)
+{
+	var_sym_tbl_free(&f->stb);
+	arena_free(&f->ar);
+	f->cl = NULL;
+	f->alloc_table = NULL;
+}
 
-static void act2(struct state *st)
+static void fcall_list_append(struct fcall_list *to,
+		struct fcall_list *from);
+static void module_check(struct state *st);
+
+/* Functions are registered in source order, then calls are checked */
+void module_link(struct state *st)
 {
-	if (dbg_acts_start)
-		eprintf("\n\n------Second act begin------\n\n");
+	int i;
+
+	if (st->ctx->free_all_mem) {
+		ll_free(st->l);
+		st->l = NULL;
+	}
 
-	if (dbg_free_all_mem)
-		free(st->l);
+	for (i = 0; i < st->jobs_len; ++i) {
+		func_header_register(st->jobs[i].f, &st->global_tbl);
+		fcall_list_append(&st->fcl, &st->jobs[i].fcl);
+	}
+	module_check(st);
+}
 
+static void module_check(struct state *st)
+{
 	debug_fcall_list(&st->fcl, &st->global_tbl);
 	check_functions(&st->global_tbl, &st->fcl);
 	debug_gn_sym_tbl_post(&st->global_tbl);
-	emit_gn_specs(&st->global_tbl);
+}
+
+/* Module may be left at any point by an error, what is freed is reset */
+void module_free(struct state *st)
+{
+	struct job *j;
+	int i;
+
+	workers_free(st);
+	if (st->l)
+		ll_free(st->l);
+	st->l = NULL;
+	for (i = 0; i < st->jobs_len; ++i) {
+		j = st->jobs + i;
+		if (j->l)
+			ll_free(j->l);
+		if (j->f) {
+			func_release(j->f);
+			free(j->f);
+		}
+		fcall_list_free(&j->fcl);
+		emitter_free(&j->em);
+	}
+	free(st->jobs);
+	st->jobs = NULL;
+	st->jobs_len = st->jobs_cap = 0;
+	fcall_list_free(&st->fcl);
+	elf_free(&st->obj);
+	emitter_free(&st->em);
+	obuf_free(&st->head);
+	obuf_free(&st->tail);
+	gn_sym_tbl_free(&st->global_tbl);
+	intern_free(&st->names);
+}
+
+static void out_put(struct state *st, struct obuf *to, struct obuf *b);
+static void out_flush(struct state *st, struct obuf *b);
+static void act_end(struct state *st);
+static void object_place(struct state *st, struct job *j);
+static void object_form(struct state *st, struct obuf *head,
+		struct obuf *tail);
+
+static void act2(struct state *st)
+{
+	struct emitter *e = &st->em;
+	struct obuf *tail = &st->tail;
+	long start;
+	int i;
+
+	if (DBG(acts_start))
+		dbg_printf("\n\n------Second act begin------\n\n");
 
-	while (st->fl.first) {
-		struct func_list_el *tmp = st->fl.first;
-		st->fl.first = tmp->next;
+	module_link(st);
+
+	emitter_init(e, st->bin);
+	obuf_init(tail);
+	start = trace_now();
+	if (st->bin) {
+		elf_init(&st->obj);
+		for (i = 0; i < st->jobs_len; ++i)
+			object_place(st, st->jobs + i);
+		object_form(st, &e->out, tail);
+	} else {
+		emit_gn_specs(e, &st->global_tbl);
+	}
+	st->emit_ns += trace_now() - start;
+	st->emit_bytes += e->out.len + tail->len;
 
-		asm_emit(tmp->f);
-		if (dbg_free_all_mem) {
-			func_free(tmp->f);
-			free(tmp);
+	for (i = 0; i < st->jobs_len; ++i) {
+		out_put(st, &e->out, &st->jobs[i].em.out);
+		if (st->ctx->free_all_mem) {
+			emitter_free(&st->jobs[i].em);
+			free(st->jobs[i].f);
+			st->jobs[i].f = NULL;
 		}
 	}
+	out_flush(st, &e->out);
+	out_flush(st, tail);
+	emitter_free(e);
+	obuf_free(tail);
+	act_end(st);
+}
+
+static int stream_function(struct state *st, struct worker *w,
+		struct obuf *out);
+static void out_rewrite(struct state *st, struct obuf *b);
+
+/*
+ * Every function is written and freed as soon as it is compiled, only
+ * names and calls of the module are kept to the end. Declarations of
+ * names go after the code then. Object header depends on all of the
+ * module, so it is written over a placeholder at the end.
+ */
+static void act_stream(struct state *st)
+{
+	struct emitter *e = &st->em;
+	struct obuf *head = &st->head;
+	struct obuf *tail = &st->tail;
+	long start;
+
+	if (DBG(acts_start))
+		dbg_printf("\n\n------Streaming begin------\n\n");
+	if (st->bin && st->ctx->sink)
+		die("%s\n", msg_stream_sink);
+
+	if (st->ctx->sink == NULL)
+		st->out = open_file(st->output_file);
+	intern_init(&st->names);
+	st->l = lexem_stream(st->input_file);
+	remap_gns(st->l, &st->global_tbl, &st->names);
+	st->gl_pos.row = -1;
+	workers_init(st, 1);
+
+	emitter_init(e, st->bin);
+	obuf_init(head);
+	obuf_init(tail);
+	elf_init(&st->obj);
+	if (st->bin) {
+		memset(obuf_reserve(&e->out, elf_head_size()), 0, elf_head_size());
+		e->out.len += elf_head_size();
+	}
+	while (stream_function(st, st->workers, &e->out));
+	workers_free(st);
+	module_check(st);
 
-	if (dbg_free_all_mem)
-		gn_sym_tbl_free(&st->global_tbl);
+	start = trace_now();
+	if (st->bin)
+		object_form(st, head, tail);
+	else
+		emit_gn_specs(e, &st->global_tbl);
+	st->emit_ns += trace_now() - start;
+	st->emit_bytes += head->len + tail->len;
 
-	fclose(output_file);
+	out_flush(st, &e->out);
+	out_flush(st, tail);
+	if (st->bin)
+		out_rewrite(st, head);
+	emitter_free(e);
+	obuf_free(head);
+	obuf_free(tail);
+	act_end(st);
 }
 
-static void func_free(struct function *f)
+/* Returns 0, when the module is over */
+static int stream_function(struct state *st, struct worker *w,
+		struct obuf *out)
 {
-	var_sym_tbl_free(&f->stb);
-	cmd_list_free(f->cl);
-	alloc_free(f->alloc_table);
-	free(f);
+	struct job *j;
+	long start;
+
+	start = trace_clock(st->ctx);
+	ll_scan_upto_lt(st->l, lx_close_brace);
+	trace_end(st->ctx, ph_lexem_parse, start, NULL);
+	start = trace_clock(st->ctx);
+	remap_names(st->l, &st->global_tbl, &st->names);
+	trace_end(st->ctx, ph_remap_gns, start, NULL);
+	while (st->jobs_len == 0 && preprocess_entry(st));
+	if (st->jobs_len == 0)
+		return 0;
+
+	j = st->jobs;
+	var_map_fit(&w->vm, &st->names);
+	process_function(j, w);
+	func_header_register(j->f, &st->global_tbl);
+	fcall_list_append(&st->fcl, &j->fcl);
+	if (st->bin)
+		object_place(st, j);
+	out_put(st, out, &j->em.out);
+
+	emitter_free(&j->em);
+	if (st->ctx->free_all_mem == 0)
+		func_release(j->f);
+	free(j->f);
+	st->jobs_len = 0;
+	return 1;
+}
+
+static void debug_emit_speed(struct state *st);
+static void cache_report(struct state *st);
+
+static void act_end(struct state *st)
+{
+	int out;
+
+	debug_emit_speed(st);
+	cache_report(st);
+	if (st->ctx->free_all_mem)
+		module_free(st);
+	if (DBG(arena))
+		dbg_printf("\n----Arena----\npeak: %ld bytes\n",
+				__atomic_load_n(&st->ctx->arena_peak, __ATOMIC_RELAXED));
+
+	if (st->out == -1)
+		return;
+	out = st->out;
+	st->out = -1;
+	if (close(out) == -1) {
+		remove(st->output_file);
+		die("%s: %s\n", st->output_file, strerror(errno));
+	}
+}
+
+/* Small buffers are gathered in to, so the file is written in large chunks */
+static void out_put(struct state *st, struct obuf *to, struct obuf *b)
+{
+	if (to->len + b->len > obuf_chunk)
+		out_flush(st, to);
+	if (b->len >= obuf_chunk)
+		out_flush(st, b);
+	else
+		obuf_put(to, b->buf, b->len);
+}
+
+static void out_flush(struct state *st, struct obuf *b)
+{
+	struct ctx *c = st->ctx;
+	if (c->sink == NULL) {
+		obuf_flush(b, st->out, st->output_file);
+		return;
+	}
+	if (b->len && c->sink(c->sink_arg, b->buf, b->len))
+		die("%s\n", msg_sink_failed);
+	b->len = 0;
+}
+
+/* Overwrites the start of the file, that is already written */
+static void out_rewrite(struct state *st, struct obuf *b)
+{
+	long off = 0;
+	ssize_t got;
+
+	while (off < b->len) {
+		got = pwrite(st->out, b->buf + off, b->len - off, off);
+		if (got == -1 && errno == EINTR)
+			continue;
+		if (got == -1)
+			die("%s: %s\n", st->output_file, strerror(errno));
+		off += got;
+	}
 }
 
-static void fl_add(struct func_list *fl, struct function *f)
+static void fcall_list_append(struct fcall_list *to,
+		struct fcall_list *from)
 {
-	struct func_list_el *tmp = smalloc(sizeof(struct func_list_el));
-	if (fl->first == NULL)
-		fl->first = fl->last = tmp;
+	if (from->first == NULL)
+		return;
+	if (to->first == NULL)
+		to->first = from->first;
 	else
-		fl->last = fl->last->next = tmp;
-	tmp->f = f;
-	tmp->next = NULL;
+		to->last->next = from->first;
+	to->last = from->last;
+	from->first = from->last = NULL;
+}
+
+/* Code of every function is the buffer of its job, in source order */
+static void object_place(struct state *st, struct job *j)
+{
+	long off = elf_add_func(&st->obj, j->f->gid, j->em.out.len);
+	int k;
+
+	for (k = 0; k < j->em.rel_len; ++k)
+		elf_add_rel(&st->obj, off + j->em.rel[k].off, j->em.rel[k].gid);
+}
+
+/* Symbols of the object are global names, code is already placed */
+static void object_form(struct state *st, struct obuf *head,
+		struct obuf *tail)
+{
+	struct gn_sym_tbl *tb = &st->global_tbl;
+	struct elf_obj *o = &st->obj;
+	int i;
+
+	elf_syms_init(o, tb->len);
+	for (i = 0; i < tb->len; ++i) {
+		o->syms[i].name = tb->vec[i].name;
+		o->syms[i].defined = (tb->vec[i].info & TBL_DEF_HERE) != 0;
+		o->syms[i].global = (tb->vec[i].info & TBL_GLOBAL) != 0;
+	}
+	elf_build(o, st->input_file, head, tail);
+	elf_free(o);
+}
+
+/* Time is summed over workers, so speed is the one of a single thread */
+static void debug_emit_speed(struct state *st)
+{
+	if (DBG(emit_speed) == 0)
+		return;
+	dbg_printf("\n----Emission----\n%ld bytes in %.3f ms, %.1f MB/s\n",
+			st->emit_bytes, st->emit_ns / 1e6,
+			st->emit_ns ? st->emit_bytes * 1e3 / st->emit_ns : 0.0);
+}
+
+/* Totals of -ftime-report sum the files of the context */
+static void cache_report(struct state *st)
+{
+	struct ctx *c = st->ctx;
+
+	if (c->cache_dir == NULL)
+		return;
+	if (c->time_report) {
+		__atomic_add_fetch(&c->cache_hits, st->cache_hits, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&c->cache_misses, st->cache_misses,
+				__ATOMIC_RELAXED);
+	}
+	if (DBG(cache) == 0)
+		return;
+	dbg_printf("\n----Cache----\nhits: %d, misses: %d\n", st->cache_hits,
+			st->cache_misses);
 }
@@ -1,28 +1,61 @@
 #ifndef PROCESS_H
 #define PROCESS_H
 
+#include "ctx.h"
 #include "lparse.h"
 #include "remap.h"
-#include "cmdargs.h"
 #include "func.h"
+#include "emit.h"
+#include "elfobj.h"
 
-struct func_list_el {
+/*
+ * One function of the module. Jobs are independent of each other: the
+ * worker owns the slice, the function and the output, shared tables are
+ * only read. Everything the module gathers from them is merged in source
+ * order after all workers are done.
+ */
+struct job {
+	struct lexem_list *l;
+	int gl_spec;
 	struct function *f;
-	struct func_list_el *next;
+	struct fcall_list fcl;
+	struct emitter em;
 };
 
-struct func_list {
-	struct func_list_el *first;
-	struct func_list_el *last;
-};
+struct worker;
 
 struct state {
+	struct ctx *ctx;
+	char *input_file;
+	char *output_file;
+	int out;				/* file descriptor or -1, if sink of ctx is used */
+	int bin;				/* object file instead of assembly */
 	struct lexem_list *l;
+	struct intern_tbl names;
 	struct gn_sym_tbl global_tbl;
-	struct func_list fl;
+	struct coord gl_pos;		/* of pending global specifier */
+	struct job *jobs;
+	int jobs_len;
+	int jobs_cap;
+	int next_job;			/* first job not taken by workers */
+	struct worker *workers;
+	int workers_len;
+	int failed;
+	long emit_bytes;
+	long emit_ns;
+	int cache_hits;
+	int cache_misses;
 	struct fcall_list fcl;
+	struct elf_obj obj;		/* placement of code in the object */
+	struct emitter em;		/* output of the module around code of jobs */
+	struct obuf head;
+	struct obuf tail;
 };
 
-void process(struct settings *sts);
+int process(struct ctx *c, char *input_file, char *output_file);
+void module_parse(struct state *st, struct lexem_list *l);
+void module_compile(struct state *st, int jobs);
+void module_link(struct state *st);
+void module_free(struct state *st);
 
 #endif
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,150 +7,242 @@
 #include "lparse.h"
 #include "remap.h"
 
-struct node {
-	char *key;
-	int value;
-	char color;	/* 0 - black, 1 - red */
-	struct node *p;
-	struct node *left;
-	struct node *right;
+struct intern_entry {
+	char *str;
+	int len;
+	unsigned int hash;
+	int gn;			/* global name id or -1 */
 };
 
-struct str_tree {
-	struct node *root;
-	struct node *null;
-	int curr_val;
-};
+static int intern(struct intern_tbl *it, char *s, int len);
+static int gn_id(struct gn_sym_tbl *tb, struct intern_entry *e);
 
-static const struct node null = { NULL, -1, 0, &null, &null, &null };
+struct lexem_list *remap_gns(struct lexem_list *l, struct gn_sym_tbl *tb,
+		struct intern_tbl *it)
+{
+	tb->len = tb->cap = 0;
+	tb->vec = NULL;
+	remap_names(l, tb, it);
+	return l;
+}
 
-static struct str_tree *t_init();
-static int add_unique(struct str_tree *t, char *s);
+/* Names of lexems, that are not remapped yet, are added to tb and it */
+void remap_names(struct lexem_list *l, struct gn_sym_tbl *tb,
+		struct intern_tbl *it)
+{
+	struct lexem_block *b;
+	char *src = ll_source(l);
+
+	for (b = ll_begin(l); b != ll_end(l); ++b) {
+		int id;
+		if (b->lt == lx_global_name) {
+			id = intern(it, src + b->dt.view.off, b->dt.view.len);
+			b->dt.number = gn_id(tb, it->vec + id);
+			b->lt = lx_gn_rmp;
+		} else if (b->lt == lx_variable) {
+			id = intern(it, src + b->dt.view.off, b->dt.view.len);
+			b->dt.number = id;
+			b->lt = lx_var_interned;
+		}
+	}
+}
 
-#define REMAP(func_name, tbl_type, table_fill_func, lx_from, lx_to) \
-struct lexem_list * func_name(struct lexem_list *l, struct tbl_type *tb) \
-{ \
-	struct lexem_list *res = ll_init(); \
-	struct lexem_block bdata; \
-	struct str_tree *var_tree = t_init(); \
- \
-	while (ll_get(l, &bdata)) { \
-		if (bdata.lt == lx_from) { \
-			bdata.dt.number = add_unique(var_tree, bdata.dt.str_value); \
-			bdata.lt = lx_to; \
-		} \
-		ll_add(res, &bdata); \
-	} \
- \
-	table_fill_func(tb, var_tree); \
- \
-	free(l); \
-	free(var_tree); \
-	return res; \
+static int gn_id(struct gn_sym_tbl *tb, struct intern_entry *e)
+{
+	struct gn_tbl_entry *tmp;
+	if (e->gn != -1)
+		return e->gn;
+	if (tb->len == tb->cap) {
+		tb->cap = tb->cap ? tb->cap * 2 : tbl_init_cap;
+		tb->vec = realloc(tb->vec, tb->cap * sizeof(struct gn_tbl_entry));
+		if (tb->vec == NULL)
+			die("%s\n", strerror(ENOMEM));
+	}
+	tmp = tb->vec + tb->len;
+	tmp->name = e->str;
+	tmp->info = 0;
+	tmp->type_pattern = NULL;
+	return e->gn = tb->len++;
 }
 
-static void table_fill_gn_sym_tbl(struct gn_sym_tbl *tb,
-		struct str_tree *t);
-static void table_fill_var_sym_tbl(struct var_sym_tbl *tb,
-		struct str_tree *t);
+struct lexem_list *remap_vars(struct lexem_list *l, struct var_sym_tbl *tb,
+		struct intern_tbl *it, struct var_map *m)
+{
+	struct lexem_block *b;
+	int cap = 0;
+
+	++m->cur_gen;
+	tb->len = 0;
+	tb->vec = NULL;
+	for (b = ll_begin(l); b != ll_end(l); ++b) {
+		int id;
+		if (b->lt != lx_var_interned)
+			continue;
+		id = b->dt.number;
+		if (m->gen[id] != m->cur_gen) {
+			if (tb->len == cap) {
+				cap = cap ? cap * 2 : tbl_init_cap;
+				tb->vec = realloc(tb->vec,
+						cap * sizeof(struct var_tbl_entry));
+				if (tb->vec == NULL)
+					die("%s\n", strerror(ENOMEM));
+			}
+			tb->vec[tb->len].name = it->vec[id].str;
+			m->gen[id] = m->cur_gen;
+			m->var[id] = tb->len++;
+		}
+		b->dt.number = m->var[id];
+		b->lt = lx_var_remapped;
+	}
+	return l;
+}
+
+void var_map_init(struct var_map *m, struct intern_tbl *it)
+{
+	m->var = smalloc((it->len + 1) * sizeof(int));
+	m->gen = smalloc((it->len + 1) * sizeof(int));
+	memset(m->gen, 0, it->len * sizeof(int));
+	m->cur_gen = 0;
+	m->len = it->len;
+}
 
-REMAP(remap_gns, gn_sym_tbl, table_fill_gn_sym_tbl,
-		lx_global_name, lx_gn_rmp)
-REMAP(remap_vars, var_sym_tbl, table_fill_var_sym_tbl,
-		lx_variable, lx_var_remapped)
+/* Names interned after var_map_init get their entries */
+void var_map_fit(struct var_map *m, struct intern_tbl *it)
+{
+	int len = m->len * 2;
+	if (m->len >= it->len)
+		return;
+	if (len < it->len)
+		len = it->len;
+	m->var = realloc(m->var, len * sizeof(int));
+	m->gen = realloc(m->gen, len * sizeof(int));
+	if (m->var == NULL || m->gen == NULL)
+		die("%s\n", strerror(ENOMEM));
+	memset(m->gen + m->len, 0, (len - m->len) * sizeof(int));
+	m->len = len;
+}
 
-static void transform_tree_gn_sym_tbl(struct gn_sym_tbl *tb,
-		struct str_tree *t);
-static void transform_tree_var_sym_tbl(struct var_sym_tbl *tb,
-		struct str_tree *t);
+void var_map_free(struct var_map *m)
+{
+	free(m->var);
+	free(m->gen);
+}
 
-static void table_fill_gn_sym_tbl(struct gn_sym_tbl *tb,
-		struct str_tree *t)
+void intern_init(struct intern_tbl *it)
 {
 	int i;
-	tb->len = t->curr_val;
-	if (tb->len == 0) {
-		tb->vec = NULL;
-		return;
-	}
-	tb->vec = smalloc(tb->len * sizeof(struct gn_tbl_entry));
-	for (i = 0; i < tb->len; ++i) {
-		tb->vec[i].info = 0;
-		tb->vec[i].type_pattern = NULL;
-	}
-	transform_tree_gn_sym_tbl(tb, t);
+	it->len = 0;
+	it->cap = tbl_init_cap;
+	it->vec = smalloc(it->cap * sizeof(struct intern_entry));
+	it->slots_mask = 2 * tbl_init_cap - 1;
+	it->slots = smalloc((it->slots_mask + 1) * sizeof(int));
+	for (i = 0; i <= it->slots_mask; ++i)
+		it->slots[i] = -1;
+	arena_init(&it->ar);
 }
 
-static void table_fill_var_sym_tbl(struct var_sym_tbl *tb,
-		struct str_tree *t)
+void intern_free(struct intern_tbl *it)
 {
-	tb->len = t->curr_val;
-	if (tb->len == 0) {
-		tb->vec = NULL;
-		return;
-	}
-	tb->vec = smalloc(tb->len * sizeof(struct var_tbl_entry));
-	transform_tree_var_sym_tbl(tb, t);
+	free(it->vec);
+	free(it->slots);
+	arena_free(&it->ar);
+	it->vec = NULL;
+	it->slots = NULL;
+	it->len = it->cap = 0;
 }
 
-#define __TRANSFORM_TREE(tbl_type) \
-static void __transform_tree_ ## tbl_type(struct tbl_type *tb, \
-		struct node *null, struct node *x) \
-{ \
-	if (x != null) { \
-		__transform_tree_ ## tbl_type(tb, null, x->left); \
-		__transform_tree_ ## tbl_type(tb, null, x->right); \
-		tb->vec[x->value].name =  x->key; \
-		free(x); \
-	} \
+/* FNV-1a */
+static unsigned int name_hash(char *s, int len)
+{
+	unsigned int h = 2166136261u;
+	int i;
+	for (i = 0; i < len; ++i) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+	return h;
 }
 
-__TRANSFORM_TREE(gn_sym_tbl)
-__TRANSFORM_TREE(var_sym_tbl)
+static void intern_grow(struct intern_tbl *it);
 
-#define TRANSFORM_TREE(tbl_type) \
-static void transform_tree_ ## tbl_type(struct tbl_type *tb, \
-		struct str_tree *t) \
-{ \
-	__transform_tree_ ## tbl_type(tb, t->null, t->root); \
+/* Returns dense id of the name, adding it if it is new */
+static int intern(struct intern_tbl *it, char *s, int len)
+{
+	unsigned int h = name_hash(s, len);
+	unsigned int i = h & it->slots_mask;
+	struct intern_entry *e;
+
+	for (; it->slots[i] != -1; i = (i + 1) & it->slots_mask) {
+		e = it->vec + it->slots[i];
+		if (e->hash == h && e->len == len && memcmp(e->str, s, len) == 0)
+			return it->slots[i];
+	}
+
+	e = it->vec + it->len;
+	e->str = arena_strndup(&it->ar, s, len);
+	e->len = len;
+	e->hash = h;
+	e->gn = -1;
+	it->slots[i] = it->len++;
+	if (it->len == it->cap)
+		intern_grow(it);
+	return it->len - 1;
 }
 
-TRANSFORM_TREE(gn_sym_tbl)
-TRANSFORM_TREE(var_sym_tbl)
+/* Keeps the load factor of slots at most 1/2 */
+static void intern_grow(struct intern_tbl *it)
+{
+	int i;
+	it->cap *= 2;
+	it->vec = realloc(it->vec, it->cap * sizeof(struct intern_entry));
+	if (it->vec == NULL)
+		die("%s\n", strerror(ENOMEM));
+
+	free(it->slots);
+	it->slots_mask = 2 * it->cap - 1;
+	it->slots = smalloc((it->slots_mask + 1) * sizeof(int));
+	for (i = 0; i <= it->slots_mask; ++i)
+		it->slots[i] = -1;
+	for (i = 0; i < it->len; ++i) {
+		unsigned int j = it->vec[i].hash & it->slots_mask;
+		for (; it->slots[j] != -1; j = (j + 1) & it->slots_mask);
+		it->slots[j] = i;
+	}
+}
 
 void debug_var_sym_tbl(struct var_sym_tbl *tb, struct lexem_list *l)
 {
 	int i;
-	if (dbg_vars_remapped == 0)
+	if (DBG(vars_remapped) == 0)
 		return;
-	eprintf("--Variable remapping--\n");
-	ll_print(stderr, l);
-	eprintf("\n");
+	dbg_printf("--Variable remapping--\n");
+	ll_print(dbg_stream(), l);
+	dbg_printf("\n");
 	for (i = 0; i < tb->len; ++i) {
-		eprintf("\t%d: \'%s\'\n", i, tb->vec[i].name);
+		dbg_printf("\t%d: \'%s\'\n", i, tb->vec[i].name);
 	}
-	eprintf("\n");
+	dbg_printf("\n");
 }
 
 void debug_gn_sym_tbl_pre(struct gn_sym_tbl *tb)
 {
 	int i;
-	if (dbg_gn_pre == 0)
+	if (DBG(gn_pre) == 0)
 		return;
-	eprintf("----Global name remapping----\n");
+	dbg_printf("----Global name remapping----\n");
 	for (i = 0; i < tb->len; ++i) {
-		eprintf("\t%d: %s\n", i, tb->vec[i].name);
+		dbg_printf("\t%d: %s\n", i, tb->vec[i].name);
 	}
 }
 
 void debug_gn_sym_tbl_post(struct gn_sym_tbl *tb)
 {
 	int i;
-	if (dbg_gn_post == 0)
+	if (DBG(gn_post) == 0)
 		return;
-	eprintf("\n\n----Global name remapping----\n");
+	dbg_printf("\n\n----Global name remapping----\n");
 	for (i = 0; i < tb->len; ++i) {
-		eprintf("\t%d: f%c \'%s\' (%s)\n", i,
+		dbg_printf("\t%d: f%c \'%s\' (%s)\n", i,
 				tb->vec[i].info & TBL_GLOBAL ? 'g' :
 					tb->vec[i].info & TBL_DEF_HERE ? ' ' : 'e',
 				tb->vec[i].name, tb->vec[i].type_pattern);
@@ -160,187 +253,17 @@ void gn_sym_tbl_free(struct gn_sym_tbl *t)
 {
 	int i;
 	for (i = 0; i < t->len; ++i) {
-		free(t->vec[i].name);
 		if (t->vec[i].type_pattern)
 			free(t->vec[i].type_pattern);
 	}
 	free(t->vec);
+	t->vec = NULL;
+	t->len = t->cap = 0;
 }
 
 void var_sym_tbl_free(struct var_sym_tbl *t)
 {
-	int i;
-	for (i = 0; i < t->len; ++i) {
-		free(t->vec[i].name);
-	}
 	free(t->vec);
-}
-
-static struct node *getnode(struct str_tree *t);
-
-static struct str_tree *t_init()
-{
-	struct str_tree *tmp = smalloc(sizeof(struct str_tree));
-	tmp->null = &null;
-	tmp->root = tmp->null;
-	tmp->curr_val = 0;
-	return tmp;
-}
-
-static struct node *getnode(struct str_tree *t)
-{
-	struct node *tmp = smalloc(sizeof(struct node));
-	tmp->color = 0;
-	tmp->key = NULL;
-	tmp->value = -1;
-	tmp->p = tmp->left = tmp->right = t->null;
-	return tmp;
-}
-
-static void fixup(struct str_tree *t, struct node *x);
-
-static int add_unique(struct str_tree *t, char *s)
-{
-	int last = -1;
-	struct node *y = t->null;
-	struct node *x = t->root;
-	struct node *z;
-
-	while (x != t->null) {
-		int val;
-		y = x;
-		val = strcmp(y->key, s);
-
-		if (val == 0) {
-			free(s);
-			return y->value;
-		}
-		if (val > 0) {
-			x = x->left;
-			last = 0;
-		} else {
-			x = x->right;
-			last = 1;
-		}
-	}
-	z = getnode(t);
-	z->p = y;
-	if (y == t->null)
-		t->root = z;
-	else if (last == 0)
-		y->left = z;
-	else
-		y->right = z;
-
-	z->key = s;
-	z->value = t->curr_val;
-	++t->curr_val;
-	fixup(t, z);
-	return z->value;
-}
-
-static void right_rotate(struct str_tree *t, struct node *x);
-static void left_rotate(struct str_tree *t, struct node *x);
-
-static void fixup(struct str_tree *t, struct node *x)
-{
-	while (x->p->p != t->null && x->p->color == 1) {
-		if (x->p == x->p->p->left) {
-			struct node *y = x->p->p->right;
-			if (y->color == 1) {
-				x->p->color = y->color = 0;
-				x->p->p->color = 1;
-				x = x->p->p;
-			} else if (x == x->p->right) {
-				x = x->p;
-				left_rotate(t, x->p->p);
-			} else {
-				x->p->color = 0;
-				x->p->p->color = 1;
-				right_rotate(t, x->p->p);
-			}
-		} else {
-			struct node *y = x->p->p->left;
-			if (y->color == 1) {
-				x->p->color = y->color = 0;
-				x->p->p->color = 1;
-				x = x->p->p;
-			} else if (x == x->p->left) {
-				x = x->p;
-				right_rotate(t, x);
-			} else {
-				x->p->color = 0;
-				x->p->p->color = 1;
-				left_rotate(t, x->p->p);
-			}
-		}
-	}
-	t->root->color = 0;
-}
-
-static inline void set_parent(struct str_tree *t, struct node *x,
-		struct node *p)
-{
-	if (x != t->null)
-		x->p = p;
-}
-
-static void left_rotate(struct str_tree *t, struct node *x)
-{
-	/*
-	 *      x              y
-	 *     / \            / \
-	 *    1   y    ->    x   3
-	 *       / \        / \
-	 *      2   3      1   2
-	 */
-
-	struct node rx = *x;
-	struct node ry = *x->right;
-
-	struct node *y = x->right;
-
-	y->p = rx.p;
-	if (y->p->left == x)
-		y->p->left = y;
-	else if (y->p->right == x)
-		y->p->right = y;
-
-	y->left = x;
-	x->p = y;
-	x->right = ry.left;
-	set_parent(t, x->right, x);
-
-	if (y->p == t->null)
-		t->root = y;
-}
-
-static void right_rotate(struct str_tree *t, struct node *x)
-{
-	/*
-	 *        x          y
-	 *       / \        / \
-	 *      y   3  ->  1   x
-	 *     / \            / \
-	 *    1   2          2   3
-	 */
-
-	struct node rx = *x;
-	struct node ry = *x->left;
-
-	struct node *y = x->left;
-
-	y->p = rx.p;
-	if (y->p->left == x)
-		y->p->left = y;
-	else if (y->p->right == x)
-		y->p->right = y;
-	
-	y->right = x;
-	x->p = y;
-	x->left = ry.left;
-	set_parent(t, x->left, x);
-
-	if (y->p == t->null)
-		t->root = y;
+	t->vec = NULL;
+	t->len = 0;
 }
@@ -2,6 +2,11 @@
 #define RENAME_H
 
 #include "lparse.h"
+#include "arena.h"
+
+enum {
+	tbl_init_cap = 16
+};
 
 struct var_tbl_entry {
 	char *name;
@@ -26,11 +31,46 @@ struct gn_tbl_entry {
 struct gn_sym_tbl {
 	int len;
 	struct gn_tbl_entry *vec;
+	int cap;
+};
+
+struct intern_entry;
+
+/*
+ * Every name of the module, global or variable, stored once in the arena
+ * and identified by a dense id. Symbol tables refer to these strings.
+ */
+struct intern_tbl {
+	struct intern_entry *vec;
+	int len;
+	int cap;
+	int *slots;			/* open addressing, -1 is empty */
+	int slots_mask;
+	struct arena ar;
+};
+
+/*
+ * Scratch of remap_vars, indexed by intern id. Intern table is not
+ * changed after remap_gns, so every worker keeps its own map.
+ */
+struct var_map {
+	int *var;		/* variable id in function being remapped */
+	int *gen;		/* remap_vars call, that set var */
+	int cur_gen;
+	int len;		/* of var and gen */
 };
 
-struct lexem_list *remap_gns(struct lexem_list *l, struct gn_sym_tbl *tb);
+void intern_init(struct intern_tbl *it);
+void intern_free(struct intern_tbl *it);
+struct lexem_list *remap_gns(struct lexem_list *l, struct gn_sym_tbl *tb,
+		struct intern_tbl *it);
+void remap_names(struct lexem_list *l, struct gn_sym_tbl *tb,
+		struct intern_tbl *it);
 struct lexem_list *remap_vars(struct lexem_list *l,
-		struct var_sym_tbl *tb);
+		struct var_sym_tbl *tb, struct intern_tbl *it, struct var_map *m);
+void var_map_init(struct var_map *m, struct intern_tbl *it);
+void var_map_fit(struct var_map *m, struct intern_tbl *it);
+void var_map_free(struct var_map *m);
 void debug_gn_sym_tbl_pre(struct gn_sym_tbl *tb);
 void debug_gn_sym_tbl_post(struct gn_sym_tbl *tb);
 void debug_var_sym_tbl(struct var_sym_tbl *tb, struct lexem_list *l);
@@ -0,0 +1,150 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "global.h"
+#include "obuf.h"
+#include "trace.h"
+
+static const char *phase_names[] = {
+	[ph_act1] = "act1",
+	[ph_act2] = "act2",
+	[ph_stream] = "stream",
+	[ph_lexem_parse] = "lexem_parse",
+	[ph_remap_gns] = "remap_gns",
+	[ph_remap_vars] = "remap_vars",
+	[ph_cmd_form] = "cmd_form",
+	[ph_allocate] = "allocate",
+	[ph_asm_emit] = "asm_emit"
+};
+
+static const char *trace_head = "{\"traceEvents\":[\n";
+static const char *trace_tail = "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+long trace_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int trace_on(struct ctx *c)
+{
+	return c->time_report || c->trace_file;
+}
+
+/* Clock is not read, if spans are not reported */
+long trace_clock(struct ctx *c)
+{
+	return trace_on(c) ? trace_now() : 0;
+}
+
+void trace_end(struct ctx *c, enum phase ph, long start, char *func)
+{
+	trace_span(c, ph, start, trace_clock(c), func);
+}
+
+static void json_str(struct obuf *b, char *s);
+
+/*
+ * Phase ph took [start, end). Span of a phase of function func becomes
+ * one trace event, others are the ones of the file being compiled.
+ */
+void trace_span(struct ctx *c, enum phase ph, long start, long end,
+		char *func)
+{
+	struct obuf *b = &c->trace;
+
+	if (trace_on(c) == 0)
+		return;
+	__atomic_add_fetch(&c->phase_ns[ph], end - start, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c->phase_calls[ph], 1, __ATOMIC_RELAXED);
+	if (c->trace_file == NULL)
+		return;
+
+	pthread_mutex_lock(&c->lock);
+	if (b->buf == NULL)
+		obuf_init(b);
+	else
+		OBUF_LIT(b, ",\n");
+	obuf_printf(b, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,"
+			"\"ts\":%.3f,\"dur\":%.3f", phase_names[ph], (int)getpid(),
+			(long)syscall(SYS_gettid), start / 1e3, (end - start) / 1e3);
+	if (func || diag_file) {
+		obuf_printf(b, ",\"args\":{\"%s\":", func ? "function" : "file");
+		json_str(b, func ? func : diag_file);
+		OBUF_LIT(b, "}");
+	}
+	OBUF_LIT(b, "}");
+	pthread_mutex_unlock(&c->lock);
+}
+
+/* File names may need escapes, names of functions never do */
+static void json_str(struct obuf *b, char *s)
+{
+	OBUF_LIT(b, "\"");
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			obuf_printf(b, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			obuf_printf(b, "\\u%04x", *s);
+		else
+			obuf_put(b, s, 1);
+	}
+	OBUF_LIT(b, "\"");
+}
+
+/*
+ * Phases of functions are summed over threads, so with several jobs
+ * they may take more than the wall time.
+ */
+void trace_report(struct ctx *c, long wall_ns)
+{
+	int i;
+
+	eprintf("\n----Time report----\n");
+	eprintf("%-12s %8s %12s %7s\n", "phase", "calls", "ms", "%wall");
+	for (i = 0; i < phases_number; ++i) {
+		if (c->phase_calls[i] == 0)
+			continue;
+		eprintf("%-12s %8d %12.3f %7.1f\n", phase_names[i],
+				c->phase_calls[i], c->phase_ns[i] / 1e6,
+				wall_ns ? c->phase_ns[i] * 100.0 / wall_ns : 0.0);
+	}
+	eprintf("%-12s %8s %12.3f\n", "wall", "", wall_ns / 1e6);
+	eprintf("smalloc: %ld calls, %ld bytes\n", c->alloc_calls,
+			c->alloc_bytes);
+	eprintf("allocation: %ld variables, %ld spilled, %ld moves, "
+			"%ld copies, %ld coalesced\n", c->alloc_vars, c->alloc_spilled,
+			c->alloc_moves, c->alloc_copies, c->alloc_coalesced);
+	eprintf("frames: %ld bytes, %ld slots, %ld shared\n", c->alloc_frame,
+			c->alloc_slots, c->alloc_shared);
+	if (c->cache_dir)
+		eprintf("cache: %ld hits, %ld misses, %ld evicted\n",
+				c->cache_hits, c->cache_misses, c->cache_evicted);
+}
+
+/* Chrome trace event format, chrome://tracing and Perfetto read it */
+void trace_write(struct ctx *c)
+{
+	int fd = open(c->trace_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	struct obuf b;
+
+	if (fd == -1)
+		die("%s: %s\n", c->trace_file, strerror(errno));
+	obuf_init(&b);
+	obuf_put(&b, trace_head, strlen(trace_head));
+	if (c->trace.buf)
+		obuf_put(&b, c->trace.buf, c->trace.len);
+	obuf_put(&b, trace_tail, strlen(trace_tail));
+	obuf_flush(&b, fd, c->trace_file);
+	obuf_free(&b);
+	if (close(fd) == -1)
+		die("%s: %s\n", c->trace_file, strerror(errno));
+}
@@ -0,0 +1,28 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+struct ctx;
+
+/* Measured parts of compilation, see ctx */
+enum phase {
+	ph_act1,
+	ph_act2,
+	ph_stream,
+	ph_lexem_parse,
+	ph_remap_gns,
+	ph_remap_vars,
+	ph_cmd_form,
+	ph_allocate,
+	ph_asm_emit,
+	phases_number
+};
+
+long trace_now();
+long trace_clock(struct ctx *c);
+void trace_end(struct ctx *c, enum phase ph, long start, char *func);
+void trace_span(struct ctx *c, enum phase ph, long start, long end,
+		char *func);
+void trace_report(struct ctx *c, long wall_ns);
+void trace_write(struct ctx *c);
+
+#endif
@@ -0,0 +1,197 @@
+#include <limits.h>
+
+#include "global.h"
+#include "alloc.h"
+#include "x86.h"
+
+/* Register numbers of alloc.h to numbers of machine encoding */
+static const unsigned char hw[] = {
+	[rdi] = 7, [rsi] = 6, [rdx] = 2, [rcx] = 1, [r8] = 8, [r9] = 9,
+	[rbx] = 3, [r10] = 10, [r11] = 11, [r12] = 12, [r13] = 13, [r14] = 14,
+	[r15] = 15, [rax] = 0, [rsp] = 4, [rbp] = 5
+};
+
+enum {
+	rex_w = 0x48,
+	rex_r = 0x44,
+	rex_b = 0x41
+};
+
+static inline void put_byte(struct obuf *b, int c)
+{
+	*obuf_reserve(b, 1) = c;
+	++b->len;
+}
+
+static inline void put_le32(struct obuf *b, int v)
+{
+	unsigned char *p = (unsigned char *)obuf_reserve(b, 4);
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+	b->len += 4;
+}
+
+/*
+ * Prefix, opcode, ModRM, SIB and displacement of instruction with reg
+ * field reg (register number or opcode extension) and r/m operand op.
+ */
+static void enc_rm(struct obuf *b, int w, int opc, int reg, int op, int breg)
+{
+	int rm = hw[is_reg(op) ? op : breg];
+	int rex = (w ? rex_w : 0) | (reg & 8 ? rex_r : 0) | (rm & 8 ? rex_b : 0);
+	int disp, mod;
+
+	if (rex)
+		put_byte(b, rex);
+	put_byte(b, opc);
+	if (is_reg(op)) {
+		put_byte(b, 0xc0 | (reg & 7) << 3 | (rm & 7));
+		return;
+	}
+
+	disp = op - mem;
+	/* rbp and r13 have no form without displacement */
+	if (disp == 0 && (rm & 7) != 5)
+		mod = 0;
+	else if (disp >= -128 && disp <= 127)
+		mod = 1;
+	else
+		mod = 2;
+	put_byte(b, mod << 6 | (reg & 7) << 3 | (rm & 7));
+	/* rsp and r12 as base need SIB */
+	if ((rm & 7) == 4)
+		put_byte(b, 0x24);
+	if (mod == 1)
+		put_byte(b, disp);
+	else if (mod == 2)
+		put_le32(b, disp);
+}
+
+void x86_ins0(struct obuf *b, enum x86_ins ins)
+{
+	switch (ins) {
+	case x_ret:
+		put_byte(b, 0xc3);
+		break;
+	case x_cqo:
+		put_byte(b, rex_w);
+		put_byte(b, 0x99);
+		break;
+	default:
+		die("internal error\n");
+	}
+}
+
+/* Opcode extensions of group 3 (0xf7) */
+static const unsigned char grp3[] = {
+	[x_mul] = 4, [x_imul] = 5, [x_div] = 6, [x_idiv] = 7
+};
+
+void x86_ins1(struct obuf *b, enum x86_ins ins, int op, int breg)
+{
+	switch (ins) {
+	case x_push:
+	case x_pop:
+		if (is_reg(op)) {
+			if (hw[op] & 8)
+				put_byte(b, rex_b);
+			put_byte(b, (ins == x_push ? 0x50 : 0x58) + (hw[op] & 7));
+		} else if (ins == x_push) {
+			enc_rm(b, 0, 0xff, 6, op, breg);
+		} else {
+			enc_rm(b, 0, 0x8f, 0, op, breg);
+		}
+		break;
+	case x_mul:
+	case x_imul:
+	case x_div:
+	case x_idiv:
+		enc_rm(b, 1, 0xf7, grp3[ins], op, breg);
+		break;
+	default:
+		die("internal error\n");
+	}
+}
+
+/* Opcodes of "op r/m, reg" and "op reg, r/m" */
+static const unsigned char to_rm[] = {
+	[x_mov] = 0x89, [x_add] = 0x01, [x_sub] = 0x29
+};
+static const unsigned char from_rm[] = {
+	[x_mov] = 0x8b, [x_add] = 0x03, [x_sub] = 0x2b
+};
+
+void x86_ins2(struct obuf *b, enum x86_ins ins, int dest, int src, int breg)
+{
+	if (ins != x_mov && ins != x_add && ins != x_sub)
+		die("internal error\n");
+	if (is_reg(dest))
+		enc_rm(b, 1, from_rm[ins], hw[dest], src, breg);
+	else if (is_reg(src))
+		enc_rm(b, 1, to_rm[ins], hw[src], dest, breg);
+	else
+		die("internal error\n");
+}
+
+/*
+ * Register gets sign extended imm32 or full imm64, memory gets sign
+ * extended imm32, like "mov qword [...], num" of the text output.
+ */
+void x86_mov_imm(struct obuf *b, int dest, long long num, int breg)
+{
+	if (is_reg(dest) && (num > INT_MAX || num < INT_MIN)) {
+		put_byte(b, rex_w | (hw[dest] & 8 ? rex_b : 0));
+		put_byte(b, 0xb8 + (hw[dest] & 7));
+		put_le32(b, num);
+		put_le32(b, num >> 32);
+		return;
+	}
+	enc_rm(b, 1, 0xc7, 0, dest, breg);
+	put_le32(b, num);
+}
+
+/* "add rsp, num" or "sub rsp, -num" */
+void x86_rsp_add(struct obuf *b, int num)
+{
+	int ext = num < 0 ? 5 : 0;
+	if (num < 0)
+		num = -num;
+	if (num <= 127) {
+		enc_rm(b, 1, 0x83, ext, rsp, rsp);
+		put_byte(b, num);
+	} else {
+		enc_rm(b, 1, 0x81, ext, rsp, rsp);
+		put_le32(b, num);
+	}
+}
+
+/* Returns position of displacement, that is to be patched or relocated */
+long x86_rel32(struct obuf *b, enum x86_ins ins)
+{
+	if (ins != x_call && ins != x_jmp)
+		die("internal error\n");
+	put_byte(b, ins == x_call ? 0xe8 : 0xe9);
+	put_le32(b, 0);
+	return b->len - 4;
+}
+
+/* "jmp [rip]" and the target right after it, reaches any address */
+void x86_jmp_abs(struct obuf *b, unsigned long addr)
+{
+	put_byte(b, 0xff);
+	put_byte(b, 0x25);
+	put_le32(b, 0);
+	put_le32(b, addr);
+	put_le32(b, addr >> 32);
+}
+
+void x86_patch32(struct obuf *b, long pos, int val)
+{
+	unsigned char *p = (unsigned char *)b->buf + pos;
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
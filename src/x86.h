@@ -0,0 +1,35 @@
+#ifndef X86_H
+#define X86_H
+
+#include "obuf.h"
+
+/*
+ * Instructions, that emit.c uses. Operands are registers of alloc.h or
+ * memory locations (mem + offset from base register).
+ */
+enum x86_ins {
+	x_push,
+	x_pop,
+	x_mul,
+	x_imul,
+	x_div,
+	x_idiv,
+	x_mov,
+	x_add,
+	x_sub,
+	x_call,
+	x_jmp,
+	x_ret,
+	x_cqo
+};
+
+void x86_ins0(struct obuf *b, enum x86_ins ins);
+void x86_ins1(struct obuf *b, enum x86_ins ins, int op, int breg);
+void x86_ins2(struct obuf *b, enum x86_ins ins, int dest, int src, int breg);
+void x86_mov_imm(struct obuf *b, int dest, long long num, int breg);
+void x86_rsp_add(struct obuf *b, int num);
+long x86_rel32(struct obuf *b, enum x86_ins ins);
+void x86_jmp_abs(struct obuf *b, unsigned long addr);
+void x86_patch32(struct obuf *b, long pos, int val);
+
+#endif